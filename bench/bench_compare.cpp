@@ -0,0 +1,144 @@
+/**
+ * 比较两次基准运行的CSV结果，标出性能回退
+ *
+ * 以(suite, name, params, threads)对应两次运行中的同一用例，比较指标的相对变化。
+ * 阈值取 max(threshold, 两次运行中较大的spread)，抖动大的用例不会因为噪声被判为回退。
+ * 默认比较ns_per_op；共享机器上可以用--metric instructions_per_op，不受频率与调度影响。
+ * *_per_op越小越好，*_per_sec(ops_per_sec)越大越好，回退按指标的方向判断。
+ * 存在回退，或基线中的用例在新结果中缺失(崩溃、被跳过)时返回1，可以直接用于升级前的门禁。
+ *
+ * g++ -std=c++20 -O2 bench_compare.cpp -o bench_compare
+ * ./bench_compare base.csv new.csv [--threshold 5] [--metric ns_per_op]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct bench_result {
+        // 列名 -> 值，空列不出现
+        std::map<std::string, double> metrics;
+};
+
+using bench_results = std::map<std::string, bench_result>;
+
+static std::vector<std::string> split(const std::string& line, char sep) {
+        std::vector<std::string> ret;
+        std::stringstream ss(line);
+        std::string item;
+        while (std::getline(ss, item, sep)) ret.push_back(item);
+        if (!line.empty() && line.back() == sep) ret.push_back("");
+        return ret;
+}
+
+// 吞吐类指标越大越好，其余(每次操作的耗时与计数)越小越好
+static bool higher_is_better(const std::string& metric) {
+        const std::string suffix = "_per_sec";
+        return metric.size() >= suffix.size() && metric.compare(metric.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// 同一文件中重复出现的用例(多次追加运行)取最后一次
+static bench_results load(const char* path) {
+        std::ifstream in(path);
+        if (!in) {
+                fprintf(stderr, "can not open %s\n", path);
+                exit(2);
+        }
+
+        bench_results ret;
+        std::vector<std::string> header;
+        std::string line;
+        while (std::getline(in, line)) {
+                if (line.empty()) continue;
+                auto cols = split(line, ',');
+                if (cols.size() > 0 && cols[0] == "suite") {
+                        header = cols;
+                        continue;
+                }
+                if (header.size() < 4 || cols.size() != header.size()) {
+                        fprintf(stderr, "%s: malformed line: %s\n", path, line.c_str());
+                        exit(2);
+                }
+
+                std::string key = cols[0] + "/" + cols[1] + "/" + cols[2] + "/t=" + cols[3];
+                bench_result r;
+                for (size_t i = 4; i < cols.size(); ++i) {
+                        if (!cols[i].empty()) r.metrics[header[i]] = strtod(cols[i].c_str(), nullptr);
+                }
+                ret[key] = std::move(r);
+        }
+        return ret;
+}
+
+int main(int argc, char** argv) {
+        if (argc < 3) {
+                fprintf(stderr, "usage: %s base.csv new.csv [--threshold percent] [--metric column]\n", argv[0]);
+                return 2;
+        }
+
+        double threshold = 5;
+        std::string metric = "ns_per_op";
+        for (int i = 3; i + 1 < argc; i += 2) {
+                if (!strcmp(argv[i], "--threshold")) threshold = strtod(argv[i + 1], nullptr);
+                else if (!strcmp(argv[i], "--metric")) metric = argv[i + 1];
+                else {
+                        fprintf(stderr, "unknown option %s\n", argv[i]);
+                        return 2;
+                }
+        }
+
+        // 回退方向上的变化为正
+        const double worse_sign = higher_is_better(metric) ? -1 : 1;
+        auto base = load(argv[1]);
+        auto next = load(argv[2]);
+        size_t compared = 0, regressions = 0, improvements = 0, skipped = 0, missing = 0;
+
+        printf("%-60s %14s %14s %8s %7s\n", "case", "base", "new", "change", "limit");
+        for (auto &[key, b] : base) {
+                auto iter = next.find(key);
+                if (iter == next.end()) {
+                        printf("%-60s MISSING in %s\n", key.c_str(), argv[2]);
+                        missing++;
+                        continue;
+                }
+                auto &n = iter->second;
+                if (!b.metrics.count(metric) || !n.metrics.count(metric) || b.metrics.at(metric) <= 0) {
+                        skipped++;
+                        continue;
+                }
+
+                double bv = b.metrics.at(metric), nv = n.metrics.at(metric);
+                double change = (nv - bv) / bv * 100;
+                double noise = 0;
+                if (b.metrics.count("spread")) noise = std::max(noise, b.metrics.at("spread") * 100);
+                if (n.metrics.count("spread")) noise = std::max(noise, n.metrics.at("spread") * 100);
+                double limit = std::max(threshold, noise);
+
+                const char* verdict = "";
+                if (change * worse_sign > limit) {
+                        verdict = "REGRESSION";
+                        regressions++;
+                } else if (change * worse_sign < -limit) {
+                        verdict = "improved";
+                        improvements++;
+                }
+                compared++;
+                printf("%-60s %14.2f %14.2f %+7.1f%% %6.1f%% %s\n", key.c_str(), bv, nv, change, limit, verdict);
+        }
+        for (auto &[key, n] : next) {
+                if (!base.count(key)) printf("%-60s new case\n", key.c_str());
+        }
+
+        printf("\n%zu compared on %s, %zu regressions, %zu improvements", compared, metric.c_str(), regressions, improvements);
+        if (skipped > 0) printf(", %zu without %s", skipped, metric.c_str());
+        if (missing > 0) printf(", %zu missing", missing);
+        printf("\n");
+        return regressions == 0 && missing == 0 ? 0 : 1;
+}
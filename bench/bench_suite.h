@@ -0,0 +1,282 @@
+/**
+ * 基准套件的公共部分: 参数网格、多线程计时、硬件计数器与CSV输出
+ *
+ * 每个子系统一个可执行文件，共用以下参数:
+ *   --ring 16,256,4096     环大小(节点数)/表大小
+ *   --elem 16,256,4096     元素大小(字节)
+ *   --fill 0.5,0.9         填充率
+ *   --threads 1,4          线程数，默认为1与min(核数, BENCH_DEFAULT_THREADS)
+ *   --ops N                每个线程每次重复的最少操作数
+ *   --min-ms N             每次重复的最短时间，操作数不够时按预热结果放大
+ *   --repeat N             重复次数，取ns/op的中位数
+ *   --filter substr        只运行名字包含substr的用例
+ *   --out file.csv         追加写入结果，文件为空时先写表头
+ *
+ * 结果用bench_compare比较两次运行。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <initializer_list>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "perf_counters.h"
+
+#ifndef __Z_BENCH_SUITE
+#define __Z_BENCH_SUITE
+
+using bench_clock = std::chrono::steady_clock;
+
+// 阻止编译器把结果未被使用的计算优化掉
+template <typename T>
+inline void bench_keep(const T& value) noexcept {
+        asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// {{"ring", 1024}, {"fill", 0.5}} -> "ring=1024;fill=0.5"
+inline std::string bench_params(std::initializer_list<std::pair<const char*, double>> params) {
+        std::string ret;
+        char buf[64];
+        for (auto &p : params) {
+                snprintf(buf, sizeof(buf), "%s%s=%.15g", ret.empty() ? "" : ";", p.first, p.second);
+                ret += buf;
+        }
+        return ret;
+}
+
+#pragma region bench_options
+
+constexpr size_t BENCH_DEFAULT_THREADS = 4;
+
+struct bench_options {
+        std::vector<size_t> ring {16, 256, 4096};
+        std::vector<size_t> elem {16, 256, 4096};
+        std::vector<double> fill {0.5, 0.9};
+        // 每个线程各有一份数据的用例内存随线程数线性增长，默认不随核数无限增加
+        std::vector<size_t> threads {1, std::clamp<size_t>(std::thread::hardware_concurrency(), 2, BENCH_DEFAULT_THREADS)};
+        size_t ops {1 << 16};
+        double min_ms {50};
+        size_t repeat {5};
+        std::string filter;
+        std::string out;
+
+        static bench_options from_args(int argc, char** argv);
+
+        bool selected(const std::string& name) const noexcept {
+                return filter.empty() || name.find(filter) != std::string::npos;
+        }
+};
+
+template <typename T>
+inline std::vector<T> __bench_parse_list(const char* arg) {
+        std::vector<T> ret;
+        const char* p = arg;
+        while (*p != '\0') {
+                char* end = nullptr;
+                double v = strtod(p, &end);
+                if (end == p) break;
+                ret.push_back(static_cast<T>(v));
+                p = *end == ',' ? end + 1 : end;
+        }
+        if (ret.empty()) {
+                fprintf(stderr, "bad list argument: %s\n", arg);
+                exit(2);
+        }
+        return ret;
+}
+
+inline bench_options bench_options::from_args(int argc, char** argv) {
+        bench_options ret;
+        for (int i = 1; i < argc; ++i) {
+                if (i + 1 >= argc) {
+                        fprintf(stderr, "usage: %s [--ring L] [--elem L] [--fill L] [--threads L] [--ops N] [--min-ms N] [--repeat N] [--filter S] [--out FILE]\n", argv[0]);
+                        exit(2);
+                }
+                const char* opt = argv[i];
+                const char* arg = argv[++i];
+                if (!strcmp(opt, "--ring")) ret.ring = __bench_parse_list<size_t>(arg);
+                else if (!strcmp(opt, "--elem")) ret.elem = __bench_parse_list<size_t>(arg);
+                else if (!strcmp(opt, "--fill")) ret.fill = __bench_parse_list<double>(arg);
+                else if (!strcmp(opt, "--threads")) ret.threads = __bench_parse_list<size_t>(arg);
+                else if (!strcmp(opt, "--ops")) ret.ops = strtoull(arg, nullptr, 10);
+                else if (!strcmp(opt, "--min-ms")) ret.min_ms = strtod(arg, nullptr);
+                else if (!strcmp(opt, "--repeat")) ret.repeat = std::max<size_t>(strtoull(arg, nullptr, 10), 1);
+                else if (!strcmp(opt, "--filter")) ret.filter = arg;
+                else if (!strcmp(opt, "--out")) ret.out = arg;
+                else {
+                        fprintf(stderr, "unknown option %s\n", opt);
+                        exit(2);
+                }
+        }
+        return ret;
+}
+
+
+#pragma region bench_suite
+
+struct bench_row {
+        std::string name;
+        std::string params;
+        size_t threads {1};
+        // 一次重复中所有线程的操作总数
+        size_t ops {0};
+        double ns_per_op {0};
+        double ops_per_sec {0};
+        // 各次重复ns/op的(最大 - 最小) / 中位数，比较时作为噪声估计
+        double spread {0};
+        perf_sample counters;
+};
+
+class bench_suite {
+public:
+        bench_suite(const char* suite, const bench_options& opts);
+
+        bench_suite(const bench_suite&) = delete;
+        bench_suite& operator=(const bench_suite&) = delete;
+
+        ~bench_suite();
+
+        const bench_options& options() const noexcept {
+                return __opts;
+        }
+
+        /**
+         * 在threads个线程上各调用一次body(thread_index, ops_per_thread)并计时
+         * 先以1/8的操作数预热一次并估计耗时，一次重复不足min_ms时放大ops_per_thread，
+         * 再重复options().repeat次，ns/op为 线程数 * 耗时 / 总操作数
+         */
+        template <typename F>
+        void run(const std::string& name, const std::string& params, size_t threads, size_t ops_per_thread, F&& body);
+        /**
+         * 自行计时的用例(例如完整的一轮事件循环)，ns_per_op为每次重复的结果
+         * 与run()一样取中位数和spread后输出，不采集硬件计数器
+         */
+        void record(const std::string& name, const std::string& params, size_t threads, size_t ops, std::vector<double> ns_per_op);
+private:
+        std::string __suite;
+        const bench_options& __opts;
+        std::unique_ptr<perf_counters> __counters;
+        FILE* __out {nullptr};
+
+        void emit(const bench_row& row);
+};
+
+inline bench_suite::bench_suite(const char* suite, const bench_options& opts)
+: __suite(suite), __opts(opts), __counters(perf_counters::new_counters()) {
+        if (!__opts.out.empty()) {
+                __out = fopen(__opts.out.c_str(), "a");
+                if (__out == nullptr) {
+                        perror(__opts.out.c_str());
+                        exit(1);
+                }
+                fseek(__out, 0, SEEK_END);
+                if (ftell(__out) == 0) {
+                        fprintf(__out, "suite,name,params,threads,ops,ns_per_op,ops_per_sec,spread");
+                        for (auto name : PERF_COUNTER_NAMES) fprintf(__out, ",%s_per_op", name);
+                        fprintf(__out, "\n");
+                }
+        }
+        printf("%s: hardware counters %s\n", suite, __counters->available() ? "enabled" : "unavailable");
+}
+
+inline bench_suite::~bench_suite() {
+        if (__out != nullptr) fclose(__out);
+}
+
+template <typename F>
+inline void bench_suite::run(const std::string& name, const std::string& params, size_t threads, size_t ops_per_thread, F&& body) {
+        if (!__opts.selected(name) || threads == 0 || ops_per_thread == 0) return;
+
+        auto once = [&](size_t ops) {
+                if (threads == 1) {
+                        body(static_cast<size_t>(0), ops);
+                        return;
+                }
+                std::vector<std::thread> workers;
+                workers.reserve(threads);
+                for (size_t t = 0; t < threads; ++t) {
+                        workers.emplace_back([&body, t, ops]() { body(t, ops); });
+                }
+                for (auto &w : workers) w.join();
+        };
+
+        size_t warmup = std::max<size_t>(ops_per_thread / 8, 1);
+        auto warmup_start = bench_clock::now();
+        once(warmup);
+        double warmup_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - warmup_start).count();
+        double estimate = warmup_ns * ops_per_thread / warmup;
+        if (estimate < __opts.min_ms * 1e6) {
+                ops_per_thread = static_cast<size_t>(ops_per_thread * std::min(__opts.min_ms * 1e6 / std::max(estimate, 1.0), 1e4));
+        }
+
+        std::vector<std::pair<double, perf_sample>> reps;
+        for (size_t r = 0; r < __opts.repeat; ++r) {
+                __counters->start();
+                auto start = bench_clock::now();
+                once(ops_per_thread);
+                double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+                reps.emplace_back(ns * threads / (ops_per_thread * threads), __counters->stop());
+        }
+        std::sort(reps.begin(), reps.end(), [](auto& a, auto& b) { return a.first < b.first; });
+
+        bench_row row;
+        row.name = name;
+        row.params = params;
+        row.threads = threads;
+        row.ops = ops_per_thread * threads;
+        row.ns_per_op = reps[reps.size() / 2].first;
+        row.ops_per_sec = row.ns_per_op > 0 ? 1e9 * threads / row.ns_per_op : 0;
+        row.spread = row.ns_per_op > 0 ? (reps.back().first - reps.front().first) / row.ns_per_op : 0;
+        row.counters = reps[reps.size() / 2].second;
+        emit(row);
+}
+
+inline void bench_suite::record(const std::string& name, const std::string& params, size_t threads, size_t ops, std::vector<double> ns_per_op) {
+        if (!__opts.selected(name) || ns_per_op.empty()) return;
+        std::sort(ns_per_op.begin(), ns_per_op.end());
+
+        bench_row row;
+        row.name = name;
+        row.params = params;
+        row.threads = threads;
+        row.ops = ops;
+        row.ns_per_op = ns_per_op[ns_per_op.size() / 2];
+        row.ops_per_sec = row.ns_per_op > 0 ? 1e9 * threads / row.ns_per_op : 0;
+        row.spread = row.ns_per_op > 0 ? (ns_per_op.back() - ns_per_op.front()) / row.ns_per_op : 0;
+        emit(row);
+}
+
+inline void bench_suite::emit(const bench_row& row) {
+        double per_op[PERF_COUNTER_COUNT];
+        for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+                per_op[i] = row.counters.valid[i] ? (double)row.counters.value[i] / row.ops : -1;
+        }
+
+        printf("%-24s %-36s t=%-3zu %10.1f ns/op %12.0f ops/s  spread %5.1f%%",
+                row.name.c_str(), row.params.c_str(), row.threads, row.ns_per_op, row.ops_per_sec, row.spread * 100);
+        if (row.counters.valid[PERF_INSTRUCTIONS] && row.counters.valid[PERF_CYCLES]) {
+                printf("  %7.1f ins/op  IPC %.2f", per_op[PERF_INSTRUCTIONS], per_op[PERF_INSTRUCTIONS] / per_op[PERF_CYCLES]);
+        }
+        printf("\n");
+        fflush(stdout);
+
+        if (__out == nullptr) return;
+        fprintf(__out, "%s,%s,%s,%zu,%zu,%.3f,%.1f,%.4f", __suite.c_str(), row.name.c_str(), row.params.c_str(),
+                row.threads, row.ops, row.ns_per_op, row.ops_per_sec, row.spread);
+        // 不可用的计数器留空
+        for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+                if (per_op[i] < 0) fprintf(__out, ",");
+                else fprintf(__out, ",%.3f", per_op[i]);
+        }
+        fprintf(__out, "\n");
+        fflush(__out);
+}
+
+#endif
@@ -0,0 +1,355 @@
+/**
+ * 协程与回调两种写法在同一个loopback负载上的对比
+ *
+ * 单线程里同时运行echo服务端与客户端，每个客户端连接顺序发送固定大小的请求并等待回显。
+ * 回调版本是目前的写法: 每一跳构造一个捕获上下文的std::function。
+ * 统计稳态阶段每个请求的全局堆分配次数与请求延迟分位数。
+ *
+ * callback_echo    回调写法，elem为消息大小
+ * coroutine_echo   协程写法
+ *
+ * 每次重复是完整的一轮: BENCH_CONNECTIONS个连接，共约--ops个请求，ns/op为稳态阶段每个请求的耗时。
+ * 单线程运行，--threads不影响本套件。
+ *
+ * g++ -std=c++20 -O2 -pthread -I../src/include coroutine_bench.cpp -o coroutine_bench
+ * ./coroutine_bench [--elem 16,256,4096] [--ops N] [--repeat N] [--out results.csv]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <vector>
+
+#include "bench_suite.h"
+#include "internet/coroutine.h"
+
+#pragma region Allocation Counter
+
+static std::atomic<size_t> g_allocations {0};
+
+void* operator new(size_t size) {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+        if (void* p = malloc(size ? size : 1)) return p;
+        throw std::bad_alloc();
+}
+// 不内联，否则GCC在调用处看到operator new分配的指针传给free会误报-Wmismatched-new-delete
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+        free(p);
+}
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+        free(p);
+}
+
+constexpr size_t BENCH_CONNECTIONS = 64;
+
+struct bench_config {
+        size_t connections;
+        size_t requests;
+        size_t message;
+        // 前warmup个请求不计入统计
+        size_t warmup;
+};
+
+struct bench_result {
+        std::vector<double> latency_us;
+        size_t allocations {0};
+        size_t measured {0};
+        double seconds {0};
+};
+
+static void report(const char* name, bench_result& r) {
+        std::sort(r.latency_us.begin(), r.latency_us.end());
+        auto pct = [&r](double p) {
+                return r.latency_us.empty() ? 0.0 : r.latency_us[std::min(r.latency_us.size() - 1, (size_t)(p * r.latency_us.size()))];
+        };
+        printf("%-24s %10.0f req/s  p50 %7.1f us  p99 %7.1f us  p999 %7.1f us  allocs/req %.3f\n",
+                name, r.measured / r.seconds, pct(0.5), pct(0.99), pct(0.999),
+                r.measured == 0 ? 0.0 : (double)r.allocations / r.measured);
+}
+
+
+#pragma region Coroutine
+
+static task<void> co_echo(async_socket sock, size_t message) {
+        std::vector<char> buf(message);
+        for (;;) {
+                size_t n = co_await sock.read(buf.data(), buf.size());
+                if (n == 0) co_return;
+                co_await sock.write(buf.data(), n);
+        }
+}
+
+static task<void> co_server(scheduler& s, async_listener& listener, size_t connections, size_t message) {
+        for (size_t i = 0; i < connections; ++i) {
+                s.spawn(co_echo(co_await listener.accept(), message));
+        }
+}
+
+struct co_shared {
+        const bench_config* cfg;
+        bench_result* result;
+        size_t finished {0};
+        size_t done_requests {0};
+        size_t alloc_start {0};
+        bench_clock::time_point start;
+};
+
+static task<void> co_client(scheduler& s, port_t port, co_shared& shared) {
+        auto sock = co_await async_socket::connect(s, ipv4::new_with_addr(0x7F000001, port));
+        std::vector<char> out(shared.cfg->message, 'x'), in(shared.cfg->message);
+
+        for (size_t r = 0; r < shared.cfg->requests; ++r) {
+                auto t0 = bench_clock::now();
+                co_await sock.write(out.data(), out.size());
+                size_t got = 0;
+                while (got < in.size()) {
+                        size_t n = co_await sock.read(in.data() + got, in.size() - got);
+                        if (n == 0) co_return;
+                        got += n;
+                }
+
+                if (++shared.done_requests == shared.cfg->warmup) {
+                        shared.alloc_start = g_allocations.load();
+                        shared.start = bench_clock::now();
+                } else if (shared.done_requests > shared.cfg->warmup) {
+                        shared.result->latency_us.push_back(std::chrono::duration<double, std::micro>(bench_clock::now() - t0).count());
+                }
+        }
+
+        if (++shared.finished == shared.cfg->connections) {
+                s.stop();
+        }
+}
+
+static bench_result run_coroutine(const bench_config& cfg) {
+        bench_result result;
+        result.latency_us.reserve(cfg.connections * cfg.requests);
+
+        auto s = scheduler::new_scheduler();
+        auto listener = async_listener::new_with_endpoint(*s, ipv4::new_with_addr(0x7F000001, 0));
+        co_shared shared;
+        shared.cfg = &cfg;
+        shared.result = &result;
+
+        s->spawn(co_server(*s, listener, cfg.connections, cfg.message));
+        for (size_t i = 0; i < cfg.connections; ++i) {
+                s->spawn(co_client(*s, listener.port(), shared));
+        }
+        s->run();
+
+        result.allocations = g_allocations.load() - shared.alloc_start;
+        result.seconds = std::chrono::duration<double>(bench_clock::now() - shared.start).count();
+        result.measured = result.latency_us.size();
+        return result;
+}
+
+
+#pragma region Callback
+
+// 回调写法: 每个fd上挂一个std::function，每一跳重新构造
+struct cb_conn {
+        io_watch watch;
+        std::function<void()> on_readable, on_writable;
+        std::vector<char> buf;
+};
+
+static void cb_dispatch(io_watch* w, uint32_t events) {
+        auto c = static_cast<cb_conn*>(w->data);
+        if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && c->on_readable) {
+                auto f = std::move(c->on_readable);
+                c->on_readable = nullptr;
+                f();
+        }
+        if ((events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && c->on_writable) {
+                auto f = std::move(c->on_writable);
+                c->on_writable = nullptr;
+                f();
+        }
+}
+
+static void cb_register(event_loop& loop, cb_conn& c, int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        c.watch.fd = fd;
+        c.watch.data = &c;
+        c.watch.callback = cb_dispatch;
+        loop.watch(c.watch, EPOLLIN | EPOLLOUT | EPOLLET);
+}
+
+// 读到至少一个字节后回调
+static void cb_read(cb_conn& c, char* buf, size_t len, std::function<void(ssize_t)> done) {
+        ssize_t n = ::read(c.watch.fd, buf, len);
+        if (n >= 0) {
+                done(n);
+        } else if (errno == EAGAIN) {
+                c.on_readable = [&c, buf, len, done = std::move(done)]() mutable { cb_read(c, buf, len, std::move(done)); };
+        } else {
+                done(-1);
+        }
+}
+
+static void cb_write(cb_conn& c, const char* buf, size_t len, std::function<void()> done) {
+        while (len > 0) {
+                ssize_t n = ::send(c.watch.fd, buf, len, MSG_NOSIGNAL);
+                if (n < 0) {
+                        if (errno == EAGAIN) {
+                                c.on_writable = [&c, buf, len, done = std::move(done)]() mutable { cb_write(c, buf, len, std::move(done)); };
+                        }
+                        return;
+                }
+                buf += n;
+                len -= n;
+        }
+        done();
+}
+
+static void cb_echo(cb_conn& c) {
+        cb_read(c, c.buf.data(), c.buf.size(), [&c](ssize_t n) {
+                if (n <= 0) return;
+                cb_write(c, c.buf.data(), n, [&c]() { cb_echo(c); });
+        });
+}
+
+struct cb_client {
+        cb_conn conn;
+        std::vector<char> out;
+        size_t request {0}, got {0};
+        bench_clock::time_point t0;
+};
+
+struct cb_shared {
+        const bench_config* cfg;
+        bench_result* result;
+        event_loop* loop;
+        size_t finished {0};
+        size_t done_requests {0};
+        size_t alloc_start {0};
+        bench_clock::time_point start;
+};
+
+static void cb_request(cb_client& cl, cb_shared& shared);
+
+static void cb_response(cb_client& cl, cb_shared& shared) {
+        cb_read(cl.conn, cl.conn.buf.data() + cl.got, cl.conn.buf.size() - cl.got, [&cl, &shared](ssize_t n) {
+                if (n <= 0) return;
+                cl.got += n;
+                if (cl.got < cl.conn.buf.size()) {
+                        cb_response(cl, shared);
+                        return;
+                }
+
+                if (++shared.done_requests == shared.cfg->warmup) {
+                        shared.alloc_start = g_allocations.load();
+                        shared.start = bench_clock::now();
+                } else if (shared.done_requests > shared.cfg->warmup) {
+                        shared.result->latency_us.push_back(std::chrono::duration<double, std::micro>(bench_clock::now() - cl.t0).count());
+                }
+
+                if (++cl.request == shared.cfg->requests) {
+                        if (++shared.finished == shared.cfg->connections) shared.loop->stop();
+                        return;
+                }
+                cb_request(cl, shared);
+        });
+}
+
+static void cb_request(cb_client& cl, cb_shared& shared) {
+        cl.t0 = bench_clock::now();
+        cl.got = 0;
+        cb_write(cl.conn, cl.out.data(), cl.out.size(), [&cl, &shared]() { cb_response(cl, shared); });
+}
+
+static bench_result run_callback(const bench_config& cfg) {
+        bench_result result;
+        result.latency_us.reserve(cfg.connections * cfg.requests);
+
+        auto loop = event_loop::new_loop();
+        int lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in sa = to_sockaddr(ipv4::new_with_addr(0x7F000001, 0));
+        socklen_t len = sizeof(sa);
+        bind(lfd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa));
+        listen(lfd, SOMAXCONN);
+        getsockname(lfd, reinterpret_cast<sockaddr*>(&sa), &len);
+
+        cb_shared shared;
+        shared.cfg = &cfg;
+        shared.result = &result;
+        shared.loop = loop.get();
+
+        std::vector<std::unique_ptr<cb_conn>> servers;
+        std::vector<std::unique_ptr<cb_client>> clients;
+        for (size_t i = 0; i < cfg.connections; ++i) {
+                int cfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                connect(cfd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa));
+                int sfd = accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+
+                auto server = std::make_unique<cb_conn>();
+                server->buf.resize(cfg.message);
+                cb_register(*loop, *server, sfd);
+                cb_echo(*server);
+                servers.push_back(std::move(server));
+
+                auto client = std::make_unique<cb_client>();
+                client->out.assign(cfg.message, 'x');
+                client->conn.buf.resize(cfg.message);
+                cb_register(*loop, client->conn, cfd);
+                clients.push_back(std::move(client));
+        }
+        for (auto &cl : clients) {
+                cb_request(*cl, shared);
+        }
+        loop->run();
+
+        result.allocations = g_allocations.load() - shared.alloc_start;
+        result.seconds = std::chrono::duration<double>(bench_clock::now() - shared.start).count();
+        result.measured = result.latency_us.size();
+
+        for (auto &c : servers) close(c->watch.fd);
+        for (auto &c : clients) close(c->conn.watch.fd);
+        close(lfd);
+        return result;
+}
+
+// 重复options().repeat轮，打印中位数那一轮的延迟与分配
+static void bench_echo(bench_suite& suite, const char* name, const std::string& params, const bench_config& cfg,
+                       bench_result (*once)(const bench_config&)) {
+        if (!suite.options().selected(name)) return;
+
+        std::vector<std::pair<double, bench_result>> runs;
+        std::vector<double> ns_per_op;
+        for (size_t r = 0; r < suite.options().repeat; ++r) {
+                auto result = once(cfg);
+                double ns = result.measured == 0 ? 0.0 : result.seconds * 1e9 / result.measured;
+                ns_per_op.push_back(ns);
+                runs.emplace_back(ns, std::move(result));
+        }
+        std::sort(runs.begin(), runs.end(), [](auto& a, auto& b) { return a.first < b.first; });
+
+        auto &median = runs[runs.size() / 2].second;
+        suite.record(name, params, 1, median.measured, std::move(ns_per_op));
+        report(name, median);
+}
+
+int main(int argc, char** argv) {
+        auto opts = bench_options::from_args(argc, argv);
+        bench_suite suite("coroutine", opts);
+
+        for (auto elem : opts.elem) {
+                bench_config cfg;
+                cfg.connections = BENCH_CONNECTIONS;
+                cfg.requests = std::max<size_t>(opts.ops / BENCH_CONNECTIONS, 20);
+                cfg.message = elem;
+                cfg.warmup = cfg.connections * 10;
+
+                std::string params = bench_params({{"conns", BENCH_CONNECTIONS}, {"elem", (double)elem}});
+                bench_echo(suite, "callback_echo", params, cfg, run_callback);
+                bench_echo(suite, "coroutine_echo", params, cfg, run_coroutine);
+        }
+        return 0;
+}
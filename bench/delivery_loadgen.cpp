@@ -0,0 +1,186 @@
+/**
+ * 分片节点的负载生成器
+ *
+ * 每个线程一个delivery_client，从种子节点拉取快照后直接连到各分片，
+ * 每批queue depth个请求后flush，按批统计延迟(一批中所有请求记同一个延迟)。
+ *
+ * g++ -std=c++20 -O2 -pthread -I../src/include delivery_loadgen.cpp -o delivery_loadgen
+ * ./delivery_loadgen seed_host:port [threads] [seconds] [keys] [value_size] [depth] [get_ratio]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "delivery/client.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+struct loadgen_config {
+        ipv4 seed;
+        size_t threads {0};
+        double seconds {0};
+        size_t keys {0};
+        size_t value_size {0};
+        size_t depth {0};
+        double get_ratio {0};
+};
+
+struct loadgen_result {
+        std::vector<double> latency_us;
+        size_t ops {0};
+        size_t misses {0};
+        size_t moved {0};
+        size_t errors {0};
+};
+
+static std::string key_of(size_t i) {
+        char buf[32];
+        int n = snprintf(buf, sizeof(buf), "key:%012zu", i);
+        return std::string(buf, n);
+}
+
+static void preload(const loadgen_config& cfg) {
+        auto client = delivery_client::new_with_seed(cfg.seed);
+        std::string value(cfg.value_size, 'v');
+        auto flush = [&client]() {
+                client->flush([](size_t, const delivery_response& resp) {
+                        if (resp.status != delivery_status::OK) {
+                                throw DeliveryProtocolException("preload put failed");
+                        }
+                });
+        };
+        size_t batch = 0;
+        for (size_t i = 0; i < cfg.keys; ++i) {
+                std::string key = key_of(i);
+                if (client->queued_bytes() + sizeof(delivery_request_header) + key.size() + value.size() > DELIVERY_CLIENT_BATCH_BYTES) {
+                        flush();
+                        batch = 0;
+                }
+                client->queue(delivery_op::PUT, key, value);
+                if (++batch == 256 || i + 1 == cfg.keys) {
+                        flush();
+                        batch = 0;
+                }
+        }
+}
+
+static void worker(const loadgen_config& cfg, size_t index, std::atomic<bool>& running, loadgen_result& r) {
+        auto client = delivery_client::new_with_seed(cfg.seed);
+        std::mt19937_64 rng(index * 7919 + 1);
+        std::uniform_int_distribution<size_t> pick(0, cfg.keys - 1);
+        std::uniform_real_distribution<double> coin(0, 1);
+        std::string value(cfg.value_size, 'w');
+        std::vector<std::string> keys(cfg.depth);
+        bool moved = false;
+
+        while (running.load(std::memory_order_relaxed)) {
+                for (size_t d = 0; d < cfg.depth; ++d) {
+                        keys[d] = key_of(pick(rng));
+                        if (coin(rng) < cfg.get_ratio) {
+                                client->queue(delivery_op::GET, keys[d]);
+                        } else {
+                                client->queue(delivery_op::PUT, keys[d], value);
+                        }
+                }
+
+                auto t0 = bench_clock::now();
+                client->flush([&](size_t, const delivery_response& resp) {
+                        switch (resp.status) {
+                        case delivery_status::OK: break;
+                        case delivery_status::NOT_FOUND: r.misses++; break;
+                        case delivery_status::MOVED: r.moved++; moved = true; break;
+                        default: r.errors++;
+                        }
+                });
+                double us = std::chrono::duration<double, std::micro>(bench_clock::now() - t0).count();
+                r.latency_us.push_back(us);
+                r.ops += cfg.depth;
+
+                if (moved) {
+                        client->refresh();
+                        moved = false;
+                }
+        }
+}
+
+int main(int argc, char** argv) {
+        if (argc < 2) {
+                fprintf(stderr, "usage: %s seed_host:port [threads] [seconds] [keys] [value_size] [depth] [get_ratio]\n", argv[0]);
+                return 2;
+        }
+
+        loadgen_config cfg { ipv4::new_with_str(argv[1]) };
+        cfg.threads = argc > 2 ? strtoull(argv[2], nullptr, 10) : 4;
+        cfg.seconds = argc > 3 ? strtod(argv[3], nullptr) : 5;
+        cfg.keys = argc > 4 ? strtoull(argv[4], nullptr, 10) : 100000;
+        cfg.value_size = argc > 5 ? strtoull(argv[5], nullptr, 10) : 128;
+        cfg.depth = argc > 6 ? strtoull(argv[6], nullptr, 10) : 16;
+        cfg.get_ratio = argc > 7 ? strtod(argv[7], nullptr) : 0.9;
+        if (cfg.threads == 0 || cfg.keys == 0 || cfg.depth == 0) {
+                fprintf(stderr, "threads, keys and depth must be positive\n");
+                return 2;
+        }
+        // 一批可能全部落在同一个连接上
+        if (cfg.depth > 1 && cfg.depth * (sizeof(delivery_request_header) + key_of(0).size() + cfg.value_size) > DELIVERY_CLIENT_BATCH_BYTES) {
+                fprintf(stderr, "depth * value_size exceeds the client batch limit of %zu bytes\n", DELIVERY_CLIENT_BATCH_BYTES);
+                return 2;
+        }
+
+        try {
+                auto probe = delivery_client::new_with_seed(cfg.seed);
+                printf("ring version %lu, %zu shards; threads %zu, keys %zu, value %zu bytes, depth %zu, get ratio %.2f\n",
+                        (unsigned long)probe->version(), probe->shards(), cfg.threads, cfg.keys, cfg.value_size, cfg.depth, cfg.get_ratio);
+
+                auto t0 = bench_clock::now();
+                preload(cfg);
+                printf("preload   %zu keys in %.2f s\n", cfg.keys, std::chrono::duration<double>(bench_clock::now() - t0).count());
+
+                std::atomic<bool> running {true};
+                std::vector<loadgen_result> results(cfg.threads);
+                std::vector<std::thread> threads;
+                auto start = bench_clock::now();
+                for (size_t t = 0; t < cfg.threads; ++t) {
+                        threads.emplace_back([&cfg, t, &running, &results]() {
+                                try {
+                                        worker(cfg, t, running, results[t]);
+                                } catch (const std::exception& e) {
+                                        fprintf(stderr, "worker %zu: %s\n", t, e.what());
+                                        results[t].errors++;
+                                }
+                        });
+                }
+                std::this_thread::sleep_for(std::chrono::duration<double>(cfg.seconds));
+                running = false;
+                for (auto &t : threads) t.join();
+                double elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+                loadgen_result total;
+                for (auto &r : results) {
+                        total.latency_us.insert(total.latency_us.end(), r.latency_us.begin(), r.latency_us.end());
+                        total.ops += r.ops;
+                        total.misses += r.misses;
+                        total.moved += r.moved;
+                        total.errors += r.errors;
+                }
+                std::sort(total.latency_us.begin(), total.latency_us.end());
+                auto pct = [&total](double p) {
+                        return total.latency_us.empty() ? 0.0 : total.latency_us[std::min(total.latency_us.size() - 1, (size_t)(p * total.latency_us.size()))];
+                };
+
+                printf("run       %.0f ops/s  batch p50 %.1f us  p99 %.1f us  p999 %.1f us\n",
+                        total.ops / elapsed, pct(0.5), pct(0.99), pct(0.999));
+                printf("          %zu ops, %zu misses, %zu moved, %zu errors\n", total.ops, total.misses, total.moved, total.errors);
+                return total.errors == 0 ? 0 : 1;
+        } catch (const std::exception& e) {
+                fprintf(stderr, "loadgen: %s\n", e.what());
+                return 1;
+        }
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# 在本机启动多个分片节点进程并运行负载生成器
+#
+# ./delivery_local.sh [processes] [shards_per_process] [loadgen args...]
+# 进程i的基础端口为 7000 + 100 * i
+
+set -e
+
+cd "$(dirname "$0")"
+PROCS=${1:-2}
+SHARDS=${2:-4}
+shift 2 2>/dev/null || shift $#
+
+BUILD=${BUILD:-/tmp/delivery_bench}
+cmake -S .. -B "$BUILD" -DCMAKE_BUILD_TYPE=Release >/dev/null
+cmake --build "$BUILD" -j"$(nproc)" --target delivery_node delivery_loadgen
+
+PEERS=""
+i=0
+while [ $i -lt "$PROCS" ]; do
+        PEERS="$PEERS${PEERS:+,}127.0.0.1:$((7000 + 100 * i))"
+        i=$((i + 1))
+done
+
+PIDS=""
+cleanup() {
+        [ -n "$PIDS" ] && kill $PIDS 2>/dev/null && wait $PIDS 2>/dev/null
+        PIDS=""
+}
+trap cleanup EXIT INT TERM
+
+i=0
+while [ $i -lt "$PROCS" ]; do
+        "$BUILD/delivery_node" --listen "127.0.0.1:$((7000 + 100 * i))" --shards "$SHARDS" --peers "$PEERS" &
+        PIDS="$PIDS $!"
+        i=$((i + 1))
+done
+sleep 0.5
+
+"$BUILD/delivery_loadgen" 127.0.0.1:7000 "$@"
@@ -0,0 +1,274 @@
+/**
+ * 网络路径基准
+ *
+ * ipv4_parse       ipv4::new_with_str("a.b.c.d:port")
+ * port_churn       共享的port_allocator上acquire + release，fill为预先占用的比例
+ * timer_churn      每个线程一个timing_wheel，重新设置一个随机定时器并推进时间
+ * frame_parse      解析连续的请求帧，elem为value大小
+ * tcp_echo         loopback上阻塞发送elem字节并等待回显，服务端为单线程协程
+ * kv_get           进程内启动一个分片，每个线程一个delivery_client，每批16个GET
+ *
+ * 多线程用例在单核机器上只反映调度开销，比较时应当使用同一台机器上的两次运行。
+ *
+ * g++ -std=c++20 -O2 -pthread -I../src/include network_bench.cpp -o network_bench
+ * ./network_bench [--elem 16,256,4096] [--fill 0.5,0.9] [--threads 1,4] [--out results.csv]
+ */
+
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_suite.h"
+#include "internet/internet.h"
+#include "internet/port_allocator.h"
+#include "internet/timing_wheel.h"
+#include "internet/coroutine.h"
+#include "delivery/node.h"
+#include "delivery/client.h"
+
+constexpr size_t BENCH_ADDRS = 4096;
+constexpr size_t BENCH_TIMERS = 1 << 16;
+constexpr size_t BENCH_KEYS = 1 << 14;
+constexpr size_t BENCH_DEPTH = 16;
+
+static void bench_ipv4_parse(bench_suite& suite) {
+        std::mt19937 rng(1);
+        std::vector<std::string> addrs;
+        for (size_t i = 0; i < BENCH_ADDRS; ++i) {
+                char buf[32];
+                uint32_t a = rng();
+                snprintf(buf, sizeof(buf), "%u.%u.%u.%u:%u", a >> 24, (a >> 16) & 0xFF, (a >> 8) & 0xFF, a & 0xFF, static_cast<uint32_t>(1 + rng() % 65535));
+                addrs.push_back(buf);
+        }
+
+        for (auto threads : suite.options().threads) {
+                suite.run("ipv4_parse", "", threads, suite.options().ops, [&](size_t t, size_t n) {
+                        size_t at = t * 7919;
+                        for (size_t i = 0; i < n; ++i) {
+                                bench_keep(ipv4::new_with_str(addrs[(at + i) % BENCH_ADDRS]).addr());
+                        }
+                });
+        }
+}
+
+static void bench_ports(bench_suite& suite, double fill) {
+        ipv4 dst = ipv4::new_with_addr(0x0A000001, 80);
+
+        for (auto threads : suite.options().threads) {
+                // 不隔离释放的端口，只测位图操作；隔离时端口很快全部处于time_wait
+                auto ports = port_allocator::new_with_range(DEFAULT_ALLOC_PORT_LOW, DEFAULT_ALLOC_PORT_HIGH, DEFAULT_PORT_BUCKETS, 0);
+                size_t hold = static_cast<size_t>(ports->capacity() * fill);
+                for (size_t i = 0; i < hold; ++i) {
+                        ports->acquire(dst);
+                }
+
+                suite.run("port_churn", bench_params({{"fill", fill}}), threads, suite.options().ops, [&](size_t, size_t n) {
+                        for (size_t i = 0; i < n; ++i) {
+                                port_t p = ports->acquire(dst);
+                                if (p != 0) ports->release(dst, p);
+                        }
+                });
+        }
+}
+
+static void noop_expire(timer_node*) {}
+
+static void bench_timers(bench_suite& suite) {
+        for (auto threads : suite.options().threads) {
+                struct wheel_state {
+                        std::unique_ptr<timing_wheel> wheel;
+                        std::vector<timer_node> nodes;
+                        std::mt19937_64 rng;
+                };
+                std::vector<std::unique_ptr<wheel_state>> states;
+                for (size_t t = 0; t < threads; ++t) {
+                        auto s = std::make_unique<wheel_state>();
+                        s->wheel = timing_wheel::new_with_tick();
+                        s->nodes = std::vector<timer_node>(BENCH_TIMERS);
+                        s->rng.seed(t + 1);
+                        for (auto &node : s->nodes) {
+                                node.callback = noop_expire;
+                                s->wheel->schedule(node, 1 + s->rng() % 60000);
+                        }
+                        states.push_back(std::move(s));
+                }
+
+                suite.run("timer_churn", bench_params({{"timers", BENCH_TIMERS}}), threads, suite.options().ops, [&](size_t t, size_t n) {
+                        auto &s = *states[t];
+                        for (size_t i = 0; i < n; ++i) {
+                                s.wheel->schedule(s.nodes[s.rng() % BENCH_TIMERS], 1 + s.rng() % 60000);
+                                if ((i & 63) == 63) bench_keep(s.wheel->advance(s.wheel->now() + 1));
+                        }
+                });
+        }
+}
+
+static void bench_frames(bench_suite& suite, size_t elem) {
+        constexpr size_t FRAMES = 64;
+        std::vector<char> buf;
+        std::string value(elem, 'v');
+        for (size_t i = 0; i < FRAMES; ++i) {
+                delivery_append_request(buf, delivery_op::PUT, static_cast<uint32_t>(i), "key:000000000000", value);
+        }
+
+        suite.run("frame_parse", bench_params({{"elem", (double)elem}}), 1, suite.options().ops, [&](size_t, size_t n) {
+                size_t off = 0, need = 0;
+                delivery_request req;
+                for (size_t i = 0; i < n; ++i) {
+                        size_t used = delivery_parse_request(buf.data() + off, buf.size() - off, req, need);
+                        off = used == 0 || off + used == buf.size() ? 0 : off + used;
+                        bench_keep(req.value.data());
+                }
+        });
+}
+
+
+#pragma region loopback
+
+// 绑定127.0.0.1上的临时端口后立即关闭，返回端口号
+static port_t free_port() {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in sa = to_sockaddr(ipv4::new_with_addr(0x7F000001, 0));
+        socklen_t len = sizeof(sa);
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) != 0
+         || getsockname(fd, reinterpret_cast<sockaddr*>(&sa), &len) != 0) {
+                throw ConnectionException("bind", errno);
+        }
+        close(fd);
+        return ntohs(sa.sin_port);
+}
+
+static task<void> echo(async_socket sock, size_t size) {
+        std::vector<char> buf(size);
+        for (;;) {
+                size_t n = co_await sock.read(buf.data(), buf.size());
+                if (n == 0) co_return;
+                co_await sock.write(buf.data(), n);
+        }
+}
+
+static task<void> echo_accept(scheduler& s, async_listener& listener, size_t size) {
+        for (;;) {
+                s.spawn(echo(co_await listener.accept(), size));
+        }
+}
+
+static void read_full(int fd, char* buf, size_t len) {
+        while (len > 0) {
+                ssize_t n = ::read(fd, buf, len);
+                if (n <= 0) throw ConnectionException("read", n == 0 ? ECONNRESET : errno);
+                buf += n;
+                len -= n;
+        }
+}
+
+static void write_full(int fd, const char* buf, size_t len) {
+        while (len > 0) {
+                ssize_t n = ::send(fd, buf, len, MSG_NOSIGNAL);
+                if (n < 0) throw ConnectionException("send", errno);
+                buf += n;
+                len -= n;
+        }
+}
+
+static void bench_echo(bench_suite& suite, size_t elem) {
+        auto sched = scheduler::new_scheduler();
+        auto listener = async_listener::new_with_endpoint(*sched, ipv4::new_with_addr(0x7F000001, 0));
+        sched->spawn(echo_accept(*sched, listener, std::max<size_t>(elem, 4096)));
+        std::thread server([&sched]() { sched->run(); });
+
+        size_t max_threads = *std::max_element(suite.options().threads.begin(), suite.options().threads.end());
+        std::vector<std::unique_ptr<tcp_connection>> conns;
+        for (size_t t = 0; t < max_threads; ++t) {
+                conns.push_back(tcp_connection::new_with_endpoint(ipv4::new_with_addr(0x7F000001, listener.port())));
+                int one = 1;
+                setsockopt(conns.back()->fd(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        std::vector<std::vector<char>> bufs(max_threads, std::vector<char>(elem, 'e'));
+        for (auto threads : suite.options().threads) {
+                suite.run("tcp_echo", bench_params({{"elem", (double)elem}}), threads, std::max<size_t>(suite.options().ops / 64, 1),
+                        [&](size_t t, size_t n) {
+                                int fd = conns[t]->fd();
+                                for (size_t i = 0; i < n; ++i) {
+                                        write_full(fd, bufs[t].data(), elem);
+                                        read_full(fd, bufs[t].data(), elem);
+                                }
+                        });
+        }
+
+        conns.clear();
+        sched->stop();
+        server.join();
+}
+
+static void bench_kv(bench_suite& suite, size_t elem) {
+        ipv4 endpoint = ipv4::new_with_addr(0x7F000001, free_port());
+        auto snapshot = std::make_shared<const std::vector<char>>(delivery_build_ring({ endpoint }, 1, DEFAULT_DELIVERY_VNODES));
+        auto shard = delivery_shard::new_with_endpoint(endpoint, snapshot);
+        std::thread server([&shard]() { shard->run(); });
+
+        size_t max_threads = *std::max_element(suite.options().threads.begin(), suite.options().threads.end());
+        std::vector<std::unique_ptr<delivery_client>> clients;
+        for (size_t t = 0; t < max_threads; ++t) {
+                clients.push_back(delivery_client::new_with_seed(endpoint));
+        }
+
+        std::vector<std::string> keys;
+        std::string value(elem, 'v');
+        for (size_t i = 0; i < BENCH_KEYS; ++i) {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "key:%012zu", i);
+                keys.push_back(buf);
+                // 大的elem下256个PUT会超过单个连接一批的上限
+                if (clients[0]->queued_bytes() + sizeof(delivery_request_header) + keys.back().size() + value.size() > DELIVERY_CLIENT_BATCH_BYTES) {
+                        clients[0]->flush([](size_t, const delivery_response&) {});
+                }
+                clients[0]->queue(delivery_op::PUT, keys.back(), value);
+                if ((i + 1) % 256 == 0) clients[0]->flush([](size_t, const delivery_response&) {});
+        }
+        clients[0]->flush([](size_t, const delivery_response&) {});
+
+        for (auto threads : suite.options().threads) {
+                suite.run("kv_get", bench_params({{"elem", (double)elem}, {"depth", BENCH_DEPTH}}), threads,
+                        std::max<size_t>(suite.options().ops / 16, BENCH_DEPTH),
+                        [&](size_t t, size_t n) {
+                                auto &c = *clients[t];
+                                size_t k = t * 7919;
+                                for (size_t i = 0; i < n; i += BENCH_DEPTH) {
+                                        for (size_t d = 0; d < BENCH_DEPTH; ++d) {
+                                                c.queue(delivery_op::GET, keys[k++ % BENCH_KEYS]);
+                                        }
+                                        c.flush([](size_t, const delivery_response& resp) { bench_keep(resp.status); });
+                                }
+                        });
+        }
+
+        clients.clear();
+        shard->stop();
+        server.join();
+}
+
+int main(int argc, char** argv) {
+        auto opts = bench_options::from_args(argc, argv);
+        bench_suite suite("network", opts);
+
+        try {
+                bench_ipv4_parse(suite);
+                for (auto fill : opts.fill) {
+                        bench_ports(suite, fill);
+                }
+                bench_timers(suite);
+                for (auto elem : opts.elem) {
+                        bench_frames(suite, elem);
+                        bench_echo(suite, elem);
+                        bench_kv(suite, elem);
+                }
+        } catch (const std::exception& e) {
+                fprintf(stderr, "network bench: %s\n", e.what());
+                return 1;
+        }
+        return 0;
+}
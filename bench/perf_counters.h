@@ -0,0 +1,128 @@
+/**
+ * perf_event_open硬件计数器
+ *
+ * 计数本进程中start()之后创建的线程(inherit)，线程退出时计数并入本进程，
+ * 所以要在join所有工作线程之后再stop()。
+ * 容器、虚拟机或perf_event_paranoid限制下打不开的计数器标记为无效，基准照常运行。
+ * 设置环境变量BENCH_NO_PERF可以关闭计数器。
+ */
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <memory>
+
+#ifndef __Z_BENCH_PERF_COUNTERS
+#define __Z_BENCH_PERF_COUNTERS
+
+enum perf_counter_id {
+        PERF_CYCLES = 0,
+        PERF_INSTRUCTIONS,
+        PERF_CACHE_MISSES,
+        PERF_BRANCH_MISSES,
+        PERF_COUNTER_COUNT,
+};
+
+constexpr const char* PERF_COUNTER_NAMES[PERF_COUNTER_COUNT] = {
+        "cycles", "instructions", "cache_misses", "branch_misses",
+};
+
+struct perf_sample {
+        uint64_t value[PERF_COUNTER_COUNT] {};
+        bool valid[PERF_COUNTER_COUNT] {};
+};
+
+class perf_counters {
+public:
+        static std::unique_ptr<perf_counters> new_counters() noexcept;
+
+        perf_counters(const perf_counters&) = delete;
+        perf_counters& operator=(const perf_counters&) = delete;
+
+        ~perf_counters();
+
+        bool available() const noexcept;
+        void start() noexcept;
+        perf_sample stop() noexcept;
+private:
+        int __fd[PERF_COUNTER_COUNT];
+
+        perf_counters() noexcept {
+                for (auto &fd : __fd) fd = -1;
+        }
+
+        static int open_counter(uint32_t type, uint64_t config) noexcept;
+};
+
+inline int perf_counters::open_counter(uint32_t type, uint64_t config) noexcept {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // 计数器多于硬件寄存器时内核分时复用，按运行时间比例还原
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+inline std::unique_ptr<perf_counters> perf_counters::new_counters() noexcept {
+        std::unique_ptr<perf_counters> ret(new perf_counters());
+        if (getenv("BENCH_NO_PERF") != nullptr) {
+                return ret;
+        }
+
+        ret->__fd[PERF_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        ret->__fd[PERF_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        ret->__fd[PERF_CACHE_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        ret->__fd[PERF_BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        return ret;
+}
+
+inline perf_counters::~perf_counters() {
+        for (auto fd : __fd) {
+                if (fd >= 0) close(fd);
+        }
+}
+
+inline bool perf_counters::available() const noexcept {
+        for (auto fd : __fd) {
+                if (fd >= 0) return true;
+        }
+        return false;
+}
+
+inline void perf_counters::start() noexcept {
+        for (auto fd : __fd) {
+                if (fd < 0) continue;
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+}
+
+inline perf_sample perf_counters::stop() noexcept {
+        perf_sample ret;
+        for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+                if (__fd[i] < 0) continue;
+                ioctl(__fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+                // value, time_enabled, time_running
+                uint64_t data[3];
+                if (read(__fd[i], data, sizeof(data)) != sizeof(data) || data[2] == 0) continue;
+                ret.value[i] = data[2] < data[1]
+                        ? static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2])
+                        : data[0];
+                ret.valid[i] = true;
+        }
+        return ret;
+}
+
+#endif
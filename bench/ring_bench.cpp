@@ -0,0 +1,158 @@
+/**
+ * 环与路由表基准
+ *
+ * route            ring_snapshot_view::route，线程共享同一个快照
+ * build            从ring个节点构建快照
+ * delta            一个节点的token全部变化时的diff + apply
+ * prefix_lookup    prefix_table::lookup，表中ring条前缀，线程共享
+ * prefix_bulk      prefix_table::lookup_bulk，每批64个地址
+ *
+ * zcycle::load/access/remove还不能实例化(成员函数依赖未声明的memset、工厂函数不是static)，
+ * 这里以ring_snapshot_view::route作为环上按hash查找的基准。
+ *
+ * g++ -std=c++20 -O2 -pthread -I../src/include ring_bench.cpp -o ring_bench
+ * ./ring_bench [--ring 16,256,4096] [--threads 1,4] [--out results.csv]
+ */
+
+#include <random>
+#include <vector>
+
+#include "bench_suite.h"
+#include "ring_snapshot.h"
+#include "internet/prefix_table.h"
+
+constexpr size_t BENCH_VNODES = 64;
+constexpr size_t BENCH_HASHES = 1 << 16;
+
+static std::vector<char> build_ring(size_t nodes, uint64_t seed, uint64_t version = 1) {
+        std::mt19937_64 rng(seed);
+        auto builder = ring_snapshot_builder::new_with_version(version);
+        std::vector<uint32_t> tokens(BENCH_VNODES);
+        for (size_t n = 0; n < nodes; ++n) {
+                for (auto &t : tokens) t = static_cast<uint32_t>(rng());
+                builder.add_node(ipv4::new_with_addr(0x0A000000 + static_cast<ipv4_i>(n), 7000), tokens);
+        }
+        return builder.build();
+}
+
+static std::vector<uint32_t> random_hashes(size_t n, uint64_t seed) {
+        std::mt19937 rng(seed);
+        std::vector<uint32_t> ret(n);
+        for (auto &h : ret) h = rng();
+        return ret;
+}
+
+static void bench_route(bench_suite& suite, size_t ring) {
+        auto buf = build_ring(ring, ring);
+        auto view = ring_snapshot_view::new_with_buffer(buf.data(), buf.size());
+        auto hashes = random_hashes(BENCH_HASHES, 1);
+
+        for (auto threads : suite.options().threads) {
+                suite.run("route", bench_params({{"ring", (double)ring}, {"vnodes", BENCH_VNODES}}), threads, suite.options().ops,
+                        [&](size_t t, size_t ops) {
+                                size_t at = t * 7919;
+                                for (size_t i = 0; i < ops; ++i) {
+                                        bench_keep(view.route(hashes[(at + i) & (BENCH_HASHES - 1)]));
+                                }
+                        });
+        }
+}
+
+static void bench_build(bench_suite& suite, size_t ring) {
+        std::mt19937_64 rng(ring);
+        std::vector<std::vector<uint32_t>> tokens(ring, std::vector<uint32_t>(BENCH_VNODES));
+        for (auto &node : tokens) {
+                for (auto &t : node) t = static_cast<uint32_t>(rng());
+        }
+
+        size_t ops = std::max<size_t>(suite.options().ops / (ring * BENCH_VNODES * 16), 1);
+        suite.run("build", bench_params({{"ring", (double)ring}, {"vnodes", BENCH_VNODES}}), 1, ops,
+                [&](size_t, size_t n) {
+                        for (size_t i = 0; i < n; ++i) {
+                                auto builder = ring_snapshot_builder::new_with_version(1);
+                                for (size_t node = 0; node < ring; ++node) {
+                                        builder.add_node(ipv4::new_with_addr(0x0A000000 + static_cast<ipv4_i>(node), 7000), tokens[node]);
+                                }
+                                bench_keep(builder.build().size());
+                        }
+                });
+}
+
+static void bench_delta(bench_suite& suite, size_t ring) {
+        std::mt19937_64 rng(ring);
+        std::vector<std::vector<uint32_t>> tokens(ring, std::vector<uint32_t>(BENCH_VNODES));
+        for (auto &node : tokens) {
+                for (auto &t : node) t = static_cast<uint32_t>(rng());
+        }
+        auto build = [&](uint64_t version) {
+                auto builder = ring_snapshot_builder::new_with_version(version);
+                for (size_t n = 0; n < ring; ++n) {
+                        builder.add_node(ipv4::new_with_addr(0x0A000000 + static_cast<ipv4_i>(n), 7000), tokens[n]);
+                }
+                return builder.build();
+        };
+
+        auto base = build(1);
+        for (auto &t : tokens[ring / 2]) t = static_cast<uint32_t>(rng());
+        auto target = build(2);
+        auto base_view = ring_snapshot_view::new_with_buffer(base.data(), base.size());
+        auto target_view = ring_snapshot_view::new_with_buffer(target.data(), target.size());
+
+        size_t ops = std::max<size_t>(suite.options().ops / (ring * BENCH_VNODES * 4), 1);
+        suite.run("delta", bench_params({{"ring", (double)ring}, {"vnodes", BENCH_VNODES}}), 1, ops,
+                [&](size_t, size_t n) {
+                        for (size_t i = 0; i < n; ++i) {
+                                auto delta = ring_snapshot_diff(base_view, target_view);
+                                bench_keep(ring_snapshot_apply_delta(base_view, delta.data(), delta.size()).size());
+                        }
+                });
+}
+
+static void bench_prefix(bench_suite& suite, size_t ring) {
+        // 深度大于24的前缀各占一个tbl8组
+        auto table = prefix_table::new_with_groups(std::max(ring, DEFAULT_TBL8_GROUPS));
+        std::mt19937 rng(ring);
+        std::uniform_int_distribution<int> depth(8, 32);
+        for (size_t i = 0; i < ring; ++i) {
+                table->insert(rng(), static_cast<uint8_t>(depth(rng)), static_cast<uint32_t>(i));
+        }
+        auto addrs = random_hashes(BENCH_HASHES, 2);
+        // tbl24按需映射，先访问每一页，避免缺页计入第一次重复
+        for (uint64_t ip = 0; ip <= UINT32_MAX; ip += 1 << 18) {
+                bench_keep(table->lookup(static_cast<ipv4_i>(ip)));
+        }
+
+        for (auto threads : suite.options().threads) {
+                suite.run("prefix_lookup", bench_params({{"ring", (double)ring}}), threads, suite.options().ops,
+                        [&](size_t t, size_t ops) {
+                                size_t at = t * 7919;
+                                for (size_t i = 0; i < ops; ++i) {
+                                        bench_keep(table->lookup(addrs[(at + i) & (BENCH_HASHES - 1)]));
+                                }
+                        });
+                suite.run("prefix_bulk", bench_params({{"ring", (double)ring}}), threads, suite.options().ops,
+                        [&](size_t t, size_t ops) {
+                                constexpr size_t BATCH = 64;
+                                uint32_t values[BATCH];
+                                size_t at = (t * 7919) & (BENCH_HASHES - BATCH);
+                                for (size_t i = 0; i < ops; i += BATCH) {
+                                        table->lookup_bulk(addrs.data() + ((at + i) & (BENCH_HASHES - BATCH)), values, BATCH);
+                                        bench_keep(values[0]);
+                                }
+                        });
+        }
+}
+
+int main(int argc, char** argv) {
+        auto opts = bench_options::from_args(argc, argv);
+        bench_suite suite("ring", opts);
+
+        for (auto ring : opts.ring) {
+                if (ring == 0) continue;
+                bench_route(suite, ring);
+                bench_build(suite, ring);
+                bench_delta(suite, ring);
+                bench_prefix(suite, ring);
+        }
+        return 0;
+}
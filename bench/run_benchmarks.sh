@@ -0,0 +1,45 @@
+#!/bin/sh
+# 编译并运行全部子系统基准，结果写入CSV；给出基线时与基线比较，有回退时返回非0
+#
+# ./run_benchmarks.sh results.csv [baseline.csv] [benchmark args...]
+# 例: ./run_benchmarks.sh new.csv base.csv --threads 1,4 --repeat 7
+#     BENCH_THRESHOLD=10 BENCH_METRIC=instructions_per_op ./run_benchmarks.sh new.csv base.csv
+# 用仓库根目录的CMakeLists.txt构建到$BUILD(默认/tmp/delivery_bench)，编译选项用CXXFLAGS在首次配置时指定
+
+set -e
+
+if [ $# -lt 1 ]; then
+        echo "usage: $0 results.csv [baseline.csv] [benchmark args...]" >&2
+        exit 2
+fi
+
+# 相对路径按调用时的目录解析，之后切换到脚本所在目录
+absolute() {
+        case "$1" in
+        /*) echo "$1" ;;
+        *) echo "$PWD/$1" ;;
+        esac
+}
+
+RESULTS=$(absolute "$1")
+shift
+BASELINE=""
+if [ $# -gt 0 ] && [ "${1#--}" = "$1" ]; then
+        BASELINE=$(absolute "$1")
+        shift
+fi
+cd "$(dirname "$0")"
+
+BUILD=${BUILD:-/tmp/delivery_bench}
+SUITES="ring_bench storage_bench network_bench timing_wheel_bench coroutine_bench"
+cmake -S .. -B "$BUILD" -DCMAKE_BUILD_TYPE=Release >/dev/null
+cmake --build "$BUILD" -j"$(nproc)" --target $SUITES bench_compare
+
+rm -f "$RESULTS"
+for b in $SUITES; do
+        "$BUILD/$b" --out "$RESULTS" "$@"
+done
+
+if [ -n "$BASELINE" ]; then
+        "$BUILD/bench_compare" "$BASELINE" "$RESULTS" --threshold "${BENCH_THRESHOLD:-5}" --metric "${BENCH_METRIC:-ns_per_op}"
+fi
@@ -0,0 +1,170 @@
+/**
+ * 存储基准
+ *
+ * 每个线程一个独立的实例(与分片节点相同的无共享方式)，线程数增加时看扩展性。
+ * 每个线程最多STORE_CAPACITY个key，所有线程合计超过STORE_MEMORY_BUDGET时按比例减少(params中的keys)，
+ * fill为预先写入的比例，elem为value大小。每组参数结束后实例即释放，不跨组累积。
+ *
+ * arena_churn      page_arena上随机释放一个活跃块再分配同样大小的块
+ * store_get        shard_store::get，只查已存在的key
+ * store_miss       shard_store::get，只查不存在的key
+ * store_overwrite  同样大小的value覆盖已存在的key(原地写)
+ * store_churn      删除一个已存在的key，再写入一个不存在的key
+ *
+ * zPage::insert还没有实现，不能实例化，这里以shard_store(按页映射的条目)作为存储路径的基准。
+ *
+ * g++ -std=c++20 -O2 -pthread -I../src/include storage_bench.cpp -o storage_bench
+ * ./storage_bench [--elem 16,256,4096] [--fill 0.5,0.9] [--threads 1,4] [--out results.csv]
+ */
+
+#include <algorithm>
+#include <bit>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench_suite.h"
+#include "delivery/shard_store.h"
+
+constexpr size_t STORE_CAPACITY = 1 << 16;
+constexpr size_t STORE_MIN_CAPACITY = 1 << 10;
+constexpr size_t STORE_MEMORY_BUDGET = (size_t)1 << 30;
+
+// 每个线程的key数；条目按2的幂分级，key与条目头按64字节估计
+static size_t store_capacity(size_t threads, size_t elem) {
+        size_t block = std::bit_ceil(elem + 64);
+        return std::clamp<size_t>(STORE_MEMORY_BUDGET / (threads * block), STORE_MIN_CAPACITY, STORE_CAPACITY);
+}
+
+static std::string key_of(size_t i) {
+        char buf[32];
+        int n = snprintf(buf, sizeof(buf), "key:%012zu", i);
+        return std::string(buf, n);
+}
+
+struct store_state {
+        std::unique_ptr<shard_store> store;
+        std::vector<std::string> keys;
+        // keys中[0, live)已写入，其余未写入
+        size_t live {0};
+        std::mt19937_64 rng;
+};
+
+static std::vector<store_state> make_stores(size_t threads, size_t capacity, size_t elem, double fill) {
+        std::vector<store_state> ret(threads);
+        std::string value(elem, 'v');
+        for (size_t t = 0; t < threads; ++t) {
+                auto &s = ret[t];
+                s.store = shard_store::new_store();
+                s.rng.seed(t + 1);
+                s.keys.reserve(capacity);
+                for (size_t i = 0; i < capacity; ++i) {
+                        s.keys.push_back(key_of(i));
+                }
+                std::shuffle(s.keys.begin(), s.keys.end(), s.rng);
+                s.live = std::max<size_t>(static_cast<size_t>(capacity * fill), 1);
+                s.live = std::min(s.live, capacity - 1);
+                for (size_t i = 0; i < s.live; ++i) {
+                        s.store->put(s.keys[i], value);
+                }
+        }
+        return ret;
+}
+
+static void bench_arena(bench_suite& suite, size_t elem, double fill) {
+        for (auto threads : suite.options().threads) {
+                struct arena_state {
+                        page_arena arena;
+                        std::vector<std::pair<void*, size_t>> blocks;
+                        std::mt19937_64 rng;
+                };
+                size_t capacity = store_capacity(threads, elem);
+                std::vector<std::unique_ptr<arena_state>> states;
+                for (size_t t = 0; t < threads; ++t) {
+                        auto s = std::make_unique<arena_state>();
+                        s->rng.seed(t + 1);
+                        size_t live = std::max<size_t>(static_cast<size_t>(capacity * fill), 1);
+                        for (size_t i = 0; i < live; ++i) {
+                                size_t block = 0;
+                                void* p = s->arena.allocate(elem, block);
+                                // 先写一次，slab的缺页不计入计时
+                                memset(p, 0, block);
+                                s->blocks.emplace_back(p, block);
+                        }
+                        states.push_back(std::move(s));
+                }
+
+                suite.run("arena_churn", bench_params({{"elem", (double)elem}, {"fill", fill}, {"keys", (double)capacity}}), threads, suite.options().ops,
+                        [&](size_t t, size_t n) {
+                                auto &s = *states[t];
+                                for (size_t i = 0; i < n; ++i) {
+                                        auto &b = s.blocks[s.rng() % s.blocks.size()];
+                                        s.arena.deallocate(b.first, b.second);
+                                        b.first = s.arena.allocate(elem, b.second);
+                                        *static_cast<char*>(b.first) = 1;
+                                }
+                        });
+        }
+}
+
+static void bench_store(bench_suite& suite, size_t elem, double fill) {
+        std::string value(elem, 'w');
+
+        for (auto threads : suite.options().threads) {
+                size_t capacity = store_capacity(threads, elem);
+                std::string params = bench_params({{"elem", (double)elem}, {"fill", fill}, {"keys", (double)capacity}});
+                // 本组结束时连同arena一起释放
+                auto stores = make_stores(threads, capacity, elem, fill);
+
+                suite.run("store_get", params, threads, suite.options().ops, [&](size_t t, size_t n) {
+                        auto &s = stores[t];
+                        std::string_view v;
+                        for (size_t i = 0; i < n; ++i) {
+                                bench_keep(s.store->get(s.keys[s.rng() % s.live], v));
+                                bench_keep(v.data());
+                        }
+                });
+                suite.run("store_miss", params, threads, suite.options().ops, [&](size_t t, size_t n) {
+                        auto &s = stores[t];
+                        std::string_view v;
+                        for (size_t i = 0; i < n; ++i) {
+                                bench_keep(s.store->get(s.keys[s.live + s.rng() % (s.keys.size() - s.live)], v));
+                        }
+                });
+                suite.run("store_overwrite", params, threads, suite.options().ops, [&](size_t t, size_t n) {
+                        auto &s = stores[t];
+                        for (size_t i = 0; i < n; ++i) {
+                                s.store->put(s.keys[s.rng() % s.live], value);
+                        }
+                });
+                suite.run("store_churn", params, threads, suite.options().ops, [&](size_t t, size_t n) {
+                        auto &s = stores[t];
+                        for (size_t i = 0; i < n; ++i) {
+                                // 交换一个已写入和一个未写入的key，保持填充率不变
+                                size_t out = s.rng() % s.live;
+                                size_t in = s.live + s.rng() % (s.keys.size() - s.live);
+                                s.store->remove(s.keys[out]);
+                                s.store->put(s.keys[in], value);
+                                std::swap(s.keys[out], s.keys[in]);
+                        }
+                });
+        }
+}
+
+int main(int argc, char** argv) {
+        auto opts = bench_options::from_args(argc, argv);
+        bench_suite suite("storage", opts);
+
+        for (auto elem : opts.elem) {
+                for (auto fill : opts.fill) {
+                        if (fill <= 0 || fill >= 1) {
+                                fprintf(stderr, "fill must be in (0, 1), skip %g\n", fill);
+                                continue;
+                        }
+                        bench_arena(suite, elem, fill);
+                        bench_store(suite, elem, fill);
+                }
+        }
+        return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * timing_wheel与std::set定时器对比
+ *
+ * timers个活跃定时器，每次操作取消并重新设置一个随机定时器(连接活动刷新空闲超时)，
+ * 每CHURN_PER_TICK次操作推进一个tick，到期的定时器立即重新设置(请求deadline)。
+ * 到期回调的开销摊入每次操作。
+ *
+ * wheel_churn      timing_wheel::cancel + schedule + advance
+ * set_churn        同样的负载在std::multiset上
+ *
+ * 每个实例只在一个线程上使用，--threads不影响本套件。
+ *
+ * g++ -std=c++20 -O2 -pthread -I../src/include timing_wheel_bench.cpp -o timing_wheel_bench
+ * ./timing_wheel_bench [--ops N] [--repeat N] [--filter S] [--out results.csv]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <random>
+#include <set>
+#include <vector>
+
+#include "bench_suite.h"
+#include "internet/timing_wheel.h"
+
+constexpr uint64_t MAX_DELAY = 60000;
+constexpr size_t CHURN_PER_TICK = 1000;
+constexpr size_t BENCH_TIMERS[] = {1 << 16, 1 << 20};
+
+struct wheel_ctx {
+        timing_wheel* wheel;
+        std::mt19937_64* rng;
+        size_t fired {0};
+        size_t late {0};
+};
+
+static void on_expire(timer_node* node) {
+        auto ctx = static_cast<wheel_ctx*>(node->data);
+        ctx->fired++;
+        if (node->expires() != ctx->wheel->now()) ctx->late++;
+        ctx->wheel->schedule(*node, 1 + (*ctx->rng)() % MAX_DELAY);
+}
+
+// 返回到期时间不准的定时器数量
+static size_t bench_wheel(bench_suite& suite, size_t n) {
+        std::mt19937_64 rng(42);
+        auto wheel = timing_wheel::new_with_tick(0);
+        wheel_ctx ctx { wheel.get(), &rng };
+        std::vector<timer_node> nodes(n);
+        for (auto &node : nodes) {
+                node.callback = on_expire;
+                node.data = &ctx;
+                wheel->schedule(node, 1 + rng() % MAX_DELAY);
+        }
+
+        uint64_t tick = 0;
+        size_t since_tick = 0;
+        suite.run("wheel_churn", bench_params({{"timers", (double)n}, {"churn", CHURN_PER_TICK}}), 1, suite.options().ops,
+                [&](size_t, size_t ops) {
+                        for (size_t i = 0; i < ops; ++i) {
+                                timer_node& node = nodes[rng() % n];
+                                wheel->cancel(node);
+                                wheel->schedule(node, 1 + rng() % MAX_DELAY);
+                                if (++since_tick == CHURN_PER_TICK) {
+                                        since_tick = 0;
+                                        wheel->advance(++tick);
+                                }
+                        }
+                });
+        return ctx.late;
+}
+
+static void bench_set(bench_suite& suite, size_t n) {
+        struct set_timer {
+                std::multiset<std::pair<uint64_t, size_t>>::iterator iter;
+        };
+
+        std::mt19937_64 rng(42);
+        std::multiset<std::pair<uint64_t, size_t>> timers;
+        std::vector<set_timer> nodes(n);
+        uint64_t now = 0;
+        for (size_t i = 0; i < n; ++i) {
+                nodes[i].iter = timers.emplace(now + 1 + rng() % MAX_DELAY, i);
+        }
+
+        size_t since_tick = 0;
+        suite.run("set_churn", bench_params({{"timers", (double)n}, {"churn", CHURN_PER_TICK}}), 1, suite.options().ops,
+                [&](size_t, size_t ops) {
+                        for (size_t k = 0; k < ops; ++k) {
+                                size_t i = rng() % n;
+                                timers.erase(nodes[i].iter);
+                                nodes[i].iter = timers.emplace(now + 1 + rng() % MAX_DELAY, i);
+                                if (++since_tick < CHURN_PER_TICK) continue;
+
+                                since_tick = 0;
+                                now++;
+                                while (!timers.empty() && timers.begin()->first <= now) {
+                                        size_t j = timers.begin()->second;
+                                        timers.erase(timers.begin());
+                                        nodes[j].iter = timers.emplace(now + 1 + rng() % MAX_DELAY, j);
+                                }
+                        }
+                });
+}
+
+int main(int argc, char** argv) {
+        auto opts = bench_options::from_args(argc, argv);
+        bench_suite suite("timing_wheel", opts);
+
+        for (auto n : BENCH_TIMERS) {
+                if (size_t late = bench_wheel(suite, n)) {
+                        fprintf(stderr, "timing_wheel fired %zu timers at the wrong tick\n", late);
+                        return 1;
+                }
+                bench_set(suite, n);
+        }
+        return 0;
+}
@@ -0,0 +1,80 @@
+/**
+ * 分片节点进程
+ *
+ * g++ -std=c++20 -O2 -pthread -I../include delivery_node.cpp -o delivery_node
+ * ./delivery_node --listen 127.0.0.1:7000 --shards 4 --peers 127.0.0.1:7000,127.0.0.1:7100 [--vnodes 64] [--pin]
+ *
+ * 每个分片监听 基础端口 + 分片序号，所有进程必须使用相同的--shards、--peers与--vnodes。
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "delivery/node.h"
+
+static void usage(const char* prog) {
+        fprintf(stderr, "usage: %s --listen host:port --shards N --peers host:port[,host:port...] [--vnodes N] [--pin]\n", prog);
+        exit(2);
+}
+
+static std::vector<ipv4> parse_peers(const std::string& list) {
+        std::vector<ipv4> peers;
+        size_t start = 0;
+        while (start <= list.size()) {
+                size_t end = list.find(',', start);
+                if (end == std::string::npos) end = list.size();
+                if (end > start) peers.push_back(ipv4::new_with_str(list.substr(start, end - start)));
+                start = end + 1;
+        }
+        return peers;
+}
+
+int main(int argc, char** argv) {
+        std::string listen, peers;
+        size_t shards = 1, vnodes = DEFAULT_DELIVERY_VNODES;
+        bool pin = false;
+
+        for (int i = 1; i < argc; ++i) {
+                auto next = [&]() -> const char* {
+                        if (i + 1 >= argc) usage(argv[0]);
+                        return argv[++i];
+                };
+                if (!strcmp(argv[i], "--listen")) listen = next();
+                else if (!strcmp(argv[i], "--shards")) shards = strtoull(next(), nullptr, 10);
+                else if (!strcmp(argv[i], "--peers")) peers = next();
+                else if (!strcmp(argv[i], "--vnodes")) vnodes = strtoull(next(), nullptr, 10);
+                else if (!strcmp(argv[i], "--pin")) pin = true;
+                else usage(argv[0]);
+        }
+        if (listen.empty() || shards == 0) usage(argv[0]);
+        if (peers.empty()) peers = listen;
+
+        // 分片线程继承信号屏蔽，只有主线程在sigwait中接收
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        try {
+                auto node = delivery_node::new_with_config(ipv4::new_with_str(listen), shards, parse_peers(peers), vnodes, pin);
+                node->start();
+                fprintf(stderr, "delivery node %s: %zu shards\n", listen.c_str(), shards);
+
+                int sig = 0;
+                sigwait(&signals, &sig);
+
+                node->stop();
+                node->join();
+                fprintf(stderr, "delivery node %s: stopped by signal %d, %zu items\n", listen.c_str(), sig, node->items());
+        } catch (const std::exception& e) {
+                fprintf(stderr, "delivery node %s: %s\n", listen.c_str(), e.what());
+                return 1;
+        }
+        return 0;
+}
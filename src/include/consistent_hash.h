@@ -118,6 +118,11 @@ public:
         zcycle(zcycle&&) = default;
         zcycle& operator=(zcycle&&) = default;
 
+        // count of slots, index passed to access() should be less than it
+        size_t capacity() const noexcept {
+                return __cycle.__capacity;
+        }
+
         // find an item
         InnerType& access(const size_t) const;
         // load a new item into zcycle
@@ -0,0 +1,278 @@
+/**
+ * 分片节点的阻塞客户端，每个线程一个
+ *
+ * 从种子节点拉取环快照，按key直接把请求发给所属分片，不经过代理。
+ * 连接由routed_pool管理: 每个排队的请求持有一个lease，同一分片上在途请求过多时分散到多个连接；
+ * 快照版本变化时发布新环，离开的分片上的连接在请求结束后关闭。
+ * queue()攒一批请求，flush()按连接合并发送后依次读回响应。
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../internet/internet.h"
+#include "../internet/connection.h"
+#include "../internet/conn_pool.h"
+#include "../ring_snapshot.h"
+#include "protocol.h"
+
+#ifndef __Z_DELIVERY_CLIENT
+#define __Z_DELIVERY_CLIENT
+
+constexpr size_t DELIVERY_READ_BUFFER_CLIENT = 64 * 1024;
+// 一批中同一连接上请求的总字节数；flush先写完全部请求再读响应，请求过多时双方可能都阻塞在写上
+constexpr size_t DELIVERY_CLIENT_BATCH_BYTES = 256 * 1024;
+
+class delivery_client {
+        using pool_type = routed_pool<ring_snapshot_router>;
+public:
+        static std::unique_ptr<delivery_client> new_with_seed(const ipv4& seed);
+
+        delivery_client(const delivery_client&) = delete;
+        delivery_client& operator=(const delivery_client&) = delete;
+
+        // 重新拉取快照，版本变化时发布到连接池；已经排队的请求仍然发往原来的连接
+        void refresh();
+
+        /**
+         * 加入一个请求，返回它在本批中的序号
+         * flush()出错时整批请求被丢弃，出错的连接不再被使用
+         * 同一连接上已有请求且总大小将超过DELIVERY_CLIENT_BATCH_BYTES时抛出异常，本批不变，
+         * 调用者flush()后重新加入；单个请求不受限制
+         */
+        size_t queue(delivery_op op, std::string_view key, std::string_view value = {});
+        // 本批中单个连接上排队的最大字节数，用于在超过DELIVERY_CLIENT_BATCH_BYTES之前flush
+        size_t queued_bytes() const noexcept;
+        // 发送本批请求，按序号回调on_response(seq, resp)；resp.value只在回调中有效
+        template <typename F>
+        void flush(F&& on_response);
+
+        // 单个请求，遇到MOVED时刷新快照后重试一次
+        bool get(std::string_view key, std::string& value);
+        void put(std::string_view key, std::string_view value);
+
+        uint64_t version() const noexcept {
+                return __ring ? __ring->view().version() : 0;
+        }
+        size_t shards() const noexcept {
+                return __ring ? __ring->view().node_count() : 0;
+        }
+private:
+        // 本批中使用同一个连接的请求
+        struct batch {
+                tcp_connection* conn;
+                std::vector<pool_type::lease> leases;
+                std::vector<char> out;
+                // 响应按这个顺序返回
+                std::vector<size_t> seqs;
+        };
+
+        ipv4 __seed;
+        std::shared_ptr<const ring_snapshot_router> __ring;
+        std::unique_ptr<pool_type> __pool;
+        std::vector<batch> __batches;
+        std::vector<char> __in;
+        size_t __queued {0};
+
+        explicit delivery_client(const ipv4& seed) : __seed(seed), __in(DELIVERY_READ_BUFFER_CLIENT) {}
+
+        // 丢弃本批中未完成的请求，第done个之后的连接标记为出错
+        void abort_batch(size_t done) noexcept;
+        static void write_all(int fd, const std::vector<char>& buf);
+        // 读满一个完整响应帧，返回帧长度
+        static size_t read_frame(int fd, std::vector<char>& in, size_t& have, delivery_response& resp);
+};
+
+inline std::unique_ptr<delivery_client> delivery_client::new_with_seed(const ipv4& seed) {
+        std::unique_ptr<delivery_client> client(new delivery_client(seed));
+        client->refresh();
+        return client;
+}
+
+inline void delivery_client::write_all(int fd, const std::vector<char>& buf) {
+        size_t sent = 0;
+        while (sent < buf.size()) {
+                ssize_t n = ::send(fd, buf.data() + sent, buf.size() - sent, MSG_NOSIGNAL);
+                if (n < 0) {
+                        if (errno == EINTR) continue;
+                        throw ConnectionException("send", errno);
+                }
+                sent += n;
+        }
+}
+
+inline size_t delivery_client::read_frame(int fd, std::vector<char>& in, size_t& have, delivery_response& resp) {
+        for (;;) {
+                size_t need = 0;
+                if (size_t used = delivery_parse_response(in.data(), have, resp, need)) {
+                        return used;
+                }
+                if (need > in.size()) {
+                        in.resize(std::max(need, in.size() * 2));
+                }
+
+                ssize_t n = ::read(fd, in.data() + have, in.size() - have);
+                if (n < 0) {
+                        if (errno == EINTR) continue;
+                        throw ConnectionException("read", errno);
+                }
+                if (n == 0) {
+                        throw ConnectionException("read", ECONNRESET);
+                }
+                have += n;
+        }
+}
+
+inline void delivery_client::refresh() {
+        auto conn = tcp_connection::new_with_endpoint(__seed);
+        std::vector<char> out;
+        delivery_append_request(out, delivery_op::SNAPSHOT, 0, {});
+        write_all(conn->fd(), out);
+
+        size_t have = 0;
+        delivery_response resp;
+        read_frame(conn->fd(), __in, have, resp);
+        if (resp.status != delivery_status::OK) {
+                throw DeliveryProtocolException("seed refused snapshot request");
+        }
+
+        auto ring = ring_snapshot_router::new_with_buffer(std::vector<char>(resp.value.begin(), resp.value.end()));
+        if (__ring && __ring->view().version() == ring->view().version() && __ring->view().checksum() == ring->view().checksum()) {
+                return;
+        }
+
+        if (__pool == nullptr) {
+                __pool = pool_type::new_with_ring(ring);
+        } else {
+                // 两个节点表都按endpoint有序，归并得到离开的节点
+                std::vector<ipv4> departed;
+                auto &before = __ring->view(), &after = ring->view();
+                auto key_of = [](const ring_snapshot_node& n) { return std::make_tuple(n.addr, n.port); };
+                for (size_t i = 0, j = 0; i < before.node_count(); ++i) {
+                        while (j < after.node_count() && key_of(after.node(j)) < key_of(before.node(i))) j++;
+                        if (j == after.node_count() || key_of(after.node(j)) != key_of(before.node(i))) {
+                                departed.push_back(before.endpoint(i));
+                        }
+                }
+                __pool->publish(ring, departed);
+        }
+        __ring = std::move(ring);
+}
+
+inline size_t delivery_client::queue(delivery_op op, std::string_view key, std::string_view value) {
+        auto lease = __pool->acquire(delivery_hash(key));
+        tcp_connection* conn = &lease.connection();
+
+        auto iter = std::find_if(__batches.begin(), __batches.end(), [conn](const batch& b) { return b.conn == conn; });
+        if (iter == __batches.end()) {
+                iter = __batches.insert(__batches.end(), batch {conn, {}, {}, {}});
+        }
+
+        size_t frame = sizeof(delivery_request_header) + key.size() + value.size();
+        if (!iter->seqs.empty() && iter->out.size() + frame > DELIVERY_CLIENT_BATCH_BYTES) {
+                throw DeliveryProtocolException("batch on one connection exceeds " + std::to_string(DELIVERY_CLIENT_BATCH_BYTES) + " bytes, flush first");
+        }
+
+        size_t seq = __queued++;
+        delivery_append_request(iter->out, op, static_cast<uint32_t>(seq), key, value);
+        iter->seqs.push_back(seq);
+        iter->leases.push_back(std::move(lease));
+        return seq;
+}
+
+inline size_t delivery_client::queued_bytes() const noexcept {
+        size_t ret = 0;
+        for (auto &b : __batches) ret = std::max(ret, b.out.size());
+        return ret;
+}
+
+template <typename F>
+inline void delivery_client::flush(F&& on_response) {
+        // 已经读完响应的连接数量，出错时之后的连接上可能还有未读的响应
+        size_t done = 0;
+        try {
+                // 先把所有连接上的请求发出去，再逐个读回，各分片并行处理
+                for (auto &b : __batches) {
+                        write_all(b.conn->fd(), b.out);
+                }
+
+                for (auto &b : __batches) {
+                        size_t have = 0;
+                        for (size_t k = 0; k < b.seqs.size(); ++k) {
+                                delivery_response resp;
+                                size_t used = read_frame(b.conn->fd(), __in, have, resp);
+                                // 响应错位时连接上的后续数据都不可信，按出错处理
+                                if (resp.id != static_cast<uint32_t>(b.seqs[k])) {
+                                        throw DeliveryProtocolException("response id " + std::to_string(resp.id)
+                                                + " does not match request " + std::to_string(b.seqs[k]));
+                                }
+                                on_response(b.seqs[k], resp);
+                                memmove(__in.data(), __in.data() + used, have - used);
+                                have -= used;
+                        }
+                        done++;
+                }
+        } catch (...) {
+                abort_batch(done);
+                throw;
+        }
+
+        // 释放lease，连接回到池中
+        __batches.clear();
+        __queued = 0;
+}
+
+inline void delivery_client::abort_batch(size_t done) noexcept {
+        // 请求与响应已经错位的连接不再分配，在途请求为0后由连接池关闭
+        for (size_t i = done; i < __batches.size(); ++i) {
+                __batches[i].leases.front().fail();
+        }
+        __batches.clear();
+        __queued = 0;
+}
+
+inline bool delivery_client::get(std::string_view key, std::string& value) {
+        for (int attempt = 0; attempt < 2; ++attempt) {
+                delivery_status status = delivery_status::BAD_REQUEST;
+                queue(delivery_op::GET, key);
+                flush([&](size_t, const delivery_response& resp) {
+                        status = resp.status;
+                        if (status == delivery_status::OK) value.assign(resp.value);
+                });
+
+                if (status == delivery_status::MOVED) {
+                        refresh();
+                        continue;
+                }
+                return status == delivery_status::OK;
+        }
+        throw DeliveryProtocolException("key keeps moving");
+}
+
+inline void delivery_client::put(std::string_view key, std::string_view value) {
+        for (int attempt = 0; attempt < 2; ++attempt) {
+                delivery_status status = delivery_status::BAD_REQUEST;
+                queue(delivery_op::PUT, key, value);
+                flush([&](size_t, const delivery_response& resp) { status = resp.status; });
+
+                if (status == delivery_status::MOVED) {
+                        refresh();
+                        continue;
+                }
+                if (status != delivery_status::OK) {
+                        throw DeliveryProtocolException("put rejected");
+                }
+                return;
+        }
+        throw DeliveryProtocolException("key keeps moving");
+}
+
+#endif
@@ -0,0 +1,293 @@
+/**
+ * 无共享的分片节点
+ *
+ * 每个进程运行若干分片，每个分片一个线程、一个scheduler、一个shard_store，
+ * 监听自己的端口(基础端口 + 分片序号)。每个分片本身就是环上的一个成员，
+ * 客户端按快照直接连到key所属的分片，分片之间不转发。
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../internet/internet.h"
+#include "../internet/coroutine.h"
+#include "../ring_snapshot.h"
+#include "protocol.h"
+#include "shard_store.h"
+
+#ifndef __Z_DELIVERY_NODE
+#define __Z_DELIVERY_NODE
+
+constexpr size_t DEFAULT_DELIVERY_VNODES = 64;
+constexpr size_t DELIVERY_READ_BUFFER = 64 * 1024;
+
+// 分片i的endpoint为base.port() + i，端口范围由delivery_check_ports检查
+inline ipv4 delivery_shard_endpoint(const ipv4& base, size_t shard) noexcept {
+        return ipv4::new_with_addr(base.addr(), static_cast<port_t>(base.port() + shard));
+}
+
+// base.port()起的shards个端口必须都在1 ~ 65535之内
+inline void delivery_check_ports(const ipv4& base, size_t shards) {
+        if (base.port() == 0 || shards == 0 || shards - 1 > (size_t)UINT16_MAX - base.port()) {
+                throw InvalidIpv4Address(std::string(base) + ":" + std::to_string(base.port()) + " with " + std::to_string(shards) + " shards");
+        }
+}
+
+// 相同的参数在所有进程上得到逐字节相同的快照
+inline std::vector<char> delivery_build_ring(const std::vector<ipv4>& bases, size_t shards, size_t vnodes, uint64_t version = 1) {
+        auto builder = ring_snapshot_builder::new_with_version(version);
+        for (auto &base : bases) {
+                delivery_check_ports(base, shards);
+                for (size_t s = 0; s < shards; ++s) {
+                        ipv4 ep = delivery_shard_endpoint(base, s);
+                        std::vector<uint32_t> tokens;
+                        tokens.reserve(vnodes);
+                        for (uint32_t v = 0; v < vnodes; ++v) {
+                                char seed[12];
+                                ipv4_i addr = ep.addr();
+                                port_t port = ep.port();
+                                memcpy(seed, &addr, 4);
+                                memcpy(seed + 4, &port, 2);
+                                memcpy(seed + 6, &v, 4);
+                                memset(seed + 10, 0, 2);
+                                tokens.push_back(delivery_hash(std::string_view(seed, sizeof(seed))));
+                        }
+                        builder.add_node(ep, tokens);
+                }
+        }
+        return builder.build();
+}
+
+
+#pragma region delivery_shard
+
+class delivery_shard {
+public:
+        // 在调用线程上绑定端口，run()在分片线程上执行；同一进程的分片共享snapshot
+        static std::unique_ptr<delivery_shard> new_with_endpoint(const ipv4& endpoint, std::shared_ptr<const std::vector<char>> snapshot);
+
+        delivery_shard(const delivery_shard&) = delete;
+        delivery_shard& operator=(const delivery_shard&) = delete;
+
+        ~delivery_shard() {
+                // 没有经过run()返回时，连接的协程帧先于__listener与__store销毁
+                __sched->destroy_spawned();
+        }
+
+        // stop()后返回，返回前销毁所有连接的协程并关闭它们的socket
+        void run();
+        // 可以从其他线程调用
+        void stop() noexcept {
+                __sched->stop();
+        }
+
+        const shard_store& store() const noexcept {
+                return *__store;
+        }
+private:
+        std::unique_ptr<scheduler> __sched;
+        std::unique_ptr<async_listener> __listener;
+        std::unique_ptr<shard_store> __store;
+        // __ring指向其中的数据
+        const std::shared_ptr<const std::vector<char>> __snapshot;
+        ring_snapshot_view __ring;
+        uint32_t __self;
+
+        delivery_shard(std::unique_ptr<scheduler> sched, std::shared_ptr<const std::vector<char>> snapshot, const ring_snapshot_view& ring, uint32_t self)
+        : __sched(std::move(sched)), __store(shard_store::new_store()), __snapshot(std::move(snapshot)), __ring(ring), __self(self) {}
+
+        bool owns(std::string_view key) const {
+                return __ring.route(delivery_hash(key)) == __self;
+        }
+
+        task<void> accept_loop();
+        task<void> serve(async_socket sock);
+        void handle(const delivery_request& req, std::vector<char>& out);
+};
+
+inline std::unique_ptr<delivery_shard> delivery_shard::new_with_endpoint(const ipv4& endpoint, std::shared_ptr<const std::vector<char>> snapshot) {
+        if (snapshot == nullptr) {
+                throw RingSnapshotException("shard needs a ring snapshot");
+        }
+        auto ring = ring_snapshot_view::new_with_buffer(snapshot->data(), snapshot->size());
+
+        uint32_t self = UINT32_MAX;
+        for (size_t i = 0; i < ring.node_count(); ++i) {
+                if (ring.node(i).addr == endpoint.addr() && ring.node(i).port == endpoint.port()) {
+                        self = i;
+                        break;
+                }
+        }
+        if (self == UINT32_MAX) {
+                throw RingSnapshotException("shard " + std::string(endpoint) + ":" + std::to_string(endpoint.port()) + " is not in the ring");
+        }
+
+        std::unique_ptr<delivery_shard> shard(new delivery_shard(scheduler::new_scheduler(), std::move(snapshot), ring, self));
+        shard->__listener = std::make_unique<async_listener>(async_listener::new_with_endpoint(*shard->__sched, endpoint));
+        return shard;
+}
+
+inline void delivery_shard::run() {
+        __sched->spawn(accept_loop());
+        __sched->run();
+        // accept_loop与各连接的serve都挂起在IO上，不会自己结束
+        __sched->destroy_spawned();
+}
+
+inline task<void> delivery_shard::accept_loop() {
+        for (;;) {
+                __sched->spawn(serve(co_await __listener->accept()));
+        }
+}
+
+inline void delivery_shard::handle(const delivery_request& req, std::vector<char>& out) {
+        if (req.op == delivery_op::SNAPSHOT) {
+                delivery_append_response(out, delivery_status::OK, req.id, std::string_view(__snapshot->data(), __snapshot->size()));
+                return;
+        }
+        if (!owns(req.key)) {
+                uint64_t version = __ring.version();
+                delivery_append_response(out, delivery_status::MOVED, req.id, std::string_view(reinterpret_cast<const char*>(&version), sizeof(version)));
+                return;
+        }
+
+        std::string_view value;
+        switch (req.op) {
+        case delivery_op::GET:
+                if (__store->get(req.key, value)) {
+                        delivery_append_response(out, delivery_status::OK, req.id, value);
+                } else {
+                        delivery_append_response(out, delivery_status::NOT_FOUND, req.id);
+                }
+                break;
+        case delivery_op::PUT:
+                __store->put(req.key, req.value);
+                delivery_append_response(out, delivery_status::OK, req.id);
+                break;
+        case delivery_op::DEL:
+                delivery_append_response(out, __store->remove(req.key) ? delivery_status::OK : delivery_status::NOT_FOUND, req.id);
+                break;
+        default:
+                delivery_append_response(out, delivery_status::BAD_REQUEST, req.id);
+        }
+}
+
+// 一次读到的所有完整请求处理完后合并成一次写
+inline task<void> delivery_shard::serve(async_socket sock) {
+        std::vector<char> in(DELIVERY_READ_BUFFER), out;
+        size_t have = 0;
+
+        try {
+                for (;;) {
+                        size_t n = co_await sock.read(in.data() + have, in.size() - have);
+                        if (n == 0) co_return;
+                        have += n;
+
+                        size_t off = 0, need = 0;
+                        delivery_request req;
+                        while (size_t used = delivery_parse_request(in.data() + off, have - off, req, need)) {
+                                handle(req, out);
+                                off += used;
+                        }
+
+                        if (off > 0) {
+                                memmove(in.data(), in.data() + off, have - off);
+                                have -= off;
+                        }
+                        if (need > in.size()) {
+                                in.resize(need);
+                        }
+
+                        if (!out.empty()) {
+                                co_await sock.write(out.data(), out.size());
+                                out.clear();
+                        }
+                }
+        } catch (const std::exception& e) {
+                fprintf(stderr, "close connection: %s\n", e.what());
+        }
+}
+
+
+#pragma region delivery_node
+
+class delivery_node {
+public:
+        // listen为本进程的基础endpoint，peers为所有进程(包括自己)的基础endpoint；分片端口超过65535时抛出异常
+        static std::unique_ptr<delivery_node> new_with_config(
+                const ipv4& listen, size_t shards, const std::vector<ipv4>& peers,
+                size_t vnodes = DEFAULT_DELIVERY_VNODES, bool pin_cores = false
+        );
+
+        delivery_node(const delivery_node&) = delete;
+        delivery_node& operator=(const delivery_node&) = delete;
+
+        ~delivery_node() {
+                stop();
+                join();
+        }
+
+        void start();
+        void stop() noexcept;
+        void join();
+
+        // join之后调用
+        size_t items() const noexcept;
+private:
+        std::shared_ptr<const std::vector<char>> __snapshot;
+        std::vector<std::unique_ptr<delivery_shard>> __shards;
+        std::vector<std::thread> __threads;
+        bool __pin;
+
+        delivery_node(std::shared_ptr<const std::vector<char>> snapshot, bool pin) noexcept : __snapshot(std::move(snapshot)), __pin(pin) {}
+};
+
+inline std::unique_ptr<delivery_node> delivery_node::new_with_config(
+        const ipv4& listen, size_t shards, const std::vector<ipv4>& peers, size_t vnodes, bool pin_cores
+) {
+        delivery_check_ports(listen, shards);
+        auto snapshot = std::make_shared<const std::vector<char>>(delivery_build_ring(peers, shards, vnodes));
+        std::unique_ptr<delivery_node> node(new delivery_node(std::move(snapshot), pin_cores));
+        for (size_t s = 0; s < shards; ++s) {
+                node->__shards.push_back(delivery_shard::new_with_endpoint(delivery_shard_endpoint(listen, s), node->__snapshot));
+        }
+        return node;
+}
+
+inline void delivery_node::start() {
+        unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+        for (size_t s = 0; s < __shards.size(); ++s) {
+                __threads.emplace_back([this, s, cores]() {
+                        if (__pin) scheduler::pin_current_thread(s % cores);
+                        __shards[s]->run();
+                });
+        }
+}
+
+inline void delivery_node::stop() noexcept {
+        for (auto &shard : __shards) {
+                shard->stop();
+        }
+}
+
+inline void delivery_node::join() {
+        for (auto &t : __threads) {
+                if (t.joinable()) t.join();
+        }
+        __threads.clear();
+}
+
+inline size_t delivery_node::items() const noexcept {
+        size_t n = 0;
+        for (auto &shard : __shards) n += shard->store().size();
+        return n;
+}
+
+#endif
@@ -0,0 +1,165 @@
+/**
+ * 分片节点的二进制GET/PUT协议
+ *
+ * 请求: header(12) + key + value，响应: header(12) + value，均为本机字节序。
+ * 同一连接上可以连续发送多个请求，响应按请求顺序返回并带回请求id。
+ * 请求落在不属于该分片的key上时返回MOVED，value为服务端环快照的版本号，
+ * 客户端用SNAPSHOT重新拉取快照后直接连到所属分片。
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <exception>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef __Z_DELIVERY_PROTOCOL
+#define __Z_DELIVERY_PROTOCOL
+
+#pragma region Exceptions
+
+class DeliveryProtocolException : public std::exception {
+public:
+        explicit DeliveryProtocolException(const std::string& msg) : __msg(msg) {}
+
+        const char* what() const noexcept override {
+                return __msg.c_str();
+        }
+private:
+        std::string __msg;
+};
+
+
+#pragma region Frames
+
+enum class delivery_op : uint8_t {
+        GET = 1,
+        PUT = 2,
+        DEL = 3,
+        // 返回服务端当前的环快照
+        SNAPSHOT = 4,
+};
+
+enum class delivery_status : uint8_t {
+        OK = 0,
+        NOT_FOUND = 1,
+        MOVED = 2,
+        BAD_REQUEST = 3,
+};
+
+struct delivery_request_header {
+        uint8_t op;
+        uint8_t reserved;
+        uint16_t key_len;
+        uint32_t value_len;
+        uint32_t id;
+};
+static_assert(sizeof(delivery_request_header) == 12);
+
+struct delivery_response_header {
+        uint8_t status;
+        uint8_t reserved[3];
+        uint32_t value_len;
+        uint32_t id;
+};
+static_assert(sizeof(delivery_response_header) == 12);
+
+constexpr size_t DELIVERY_MAX_VALUE = 16 << 20;
+// 响应中可能携带整个环快照
+constexpr size_t DELIVERY_MAX_RESPONSE = 256 << 20;
+
+struct delivery_request {
+        delivery_op op;
+        uint32_t id;
+        std::string_view key;
+        std::string_view value;
+};
+
+struct delivery_response {
+        delivery_status status;
+        uint32_t id;
+        std::string_view value;
+};
+
+// 分片路由使用的key散列(FNV-1a 64折叠到32位)
+inline uint32_t delivery_hash(std::string_view key) noexcept {
+        uint64_t h = 14695981039346656037ULL;
+        for (unsigned char c : key) {
+                h = (h ^ c) * 1099511628211ULL;
+        }
+        return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+inline void delivery_append_request(std::vector<char>& out, delivery_op op, uint32_t id,
+                                    std::string_view key, std::string_view value = {}) {
+        if (key.size() > UINT16_MAX || value.size() > DELIVERY_MAX_VALUE) {
+                throw DeliveryProtocolException("key or value too large");
+        }
+        delivery_request_header h { static_cast<uint8_t>(op), 0, static_cast<uint16_t>(key.size()),
+                                    static_cast<uint32_t>(value.size()), id };
+        size_t at = out.size();
+        out.resize(at + sizeof(h) + key.size() + value.size());
+        memcpy(out.data() + at, &h, sizeof(h));
+        // 空的string_view的data()可以是nullptr，不能传给memcpy
+        if (!key.empty()) memcpy(out.data() + at + sizeof(h), key.data(), key.size());
+        if (!value.empty()) memcpy(out.data() + at + sizeof(h) + key.size(), value.data(), value.size());
+}
+
+inline void delivery_append_response(std::vector<char>& out, delivery_status status, uint32_t id,
+                                     std::string_view value = {}) {
+        delivery_response_header h { static_cast<uint8_t>(status), {0, 0, 0}, static_cast<uint32_t>(value.size()), id };
+        size_t at = out.size();
+        out.resize(at + sizeof(h) + value.size());
+        memcpy(out.data() + at, &h, sizeof(h));
+        if (!value.empty()) memcpy(out.data() + at + sizeof(h), value.data(), value.size());
+}
+
+/**
+ * 从[data, data + size)解析一个完整请求
+ * 返回帧长度，数据不完整时返回0并在need中给出完整帧所需的长度
+ */
+inline size_t delivery_parse_request(const char* data, size_t size, delivery_request& req, size_t& need) {
+        delivery_request_header h;
+        if (size < sizeof(h)) {
+                need = sizeof(h);
+                return 0;
+        }
+        memcpy(&h, data, sizeof(h));
+        if (h.op < static_cast<uint8_t>(delivery_op::GET) || h.op > static_cast<uint8_t>(delivery_op::SNAPSHOT)
+         || h.value_len > DELIVERY_MAX_VALUE) {
+                throw DeliveryProtocolException("bad request header");
+        }
+
+        need = sizeof(h) + h.key_len + h.value_len;
+        if (size < need) return 0;
+
+        req.op = static_cast<delivery_op>(h.op);
+        req.id = h.id;
+        req.key = std::string_view(data + sizeof(h), h.key_len);
+        req.value = std::string_view(data + sizeof(h) + h.key_len, h.value_len);
+        return need;
+}
+
+inline size_t delivery_parse_response(const char* data, size_t size, delivery_response& resp, size_t& need) {
+        delivery_response_header h;
+        if (size < sizeof(h)) {
+                need = sizeof(h);
+                return 0;
+        }
+        memcpy(&h, data, sizeof(h));
+        if (h.status > static_cast<uint8_t>(delivery_status::BAD_REQUEST) || h.value_len > DELIVERY_MAX_RESPONSE) {
+                throw DeliveryProtocolException("bad response header");
+        }
+
+        need = sizeof(h) + h.value_len;
+        if (size < need) return 0;
+
+        resp.status = static_cast<delivery_status>(h.status);
+        resp.id = h.id;
+        resp.value = std::string_view(data + sizeof(h), h.value_len);
+        return need;
+}
+
+#endif
@@ -0,0 +1,242 @@
+/**
+ * 单个分片的key -> value存储，只由所属分片线程访问
+ *
+ * 条目(key + value)放在按页映射的内存中，写入后地址不变，索引直接引用条目中的key。
+ * 按2的幂分级复用空闲块，超过最大级别的条目单独映射。
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../storage/zstorage.h"
+
+#ifndef __Z_SHARD_STORE
+#define __Z_SHARD_STORE
+
+#pragma region page_arena
+
+// 32B ~ 32KB
+constexpr size_t ARENA_MIN_SHIFT = 5;
+constexpr size_t ARENA_CLASSES = 11;
+constexpr size_t ARENA_SLAB = BASE_ALLOCATOR_UNIT * 64;
+
+// 析构时归还所有slab；超过最大级别、单独映射的块需要调用者deallocate
+class page_arena {
+public:
+        page_arena() noexcept {}
+        page_arena(const page_arena&) = delete;
+        page_arena& operator=(const page_arena&) = delete;
+
+        ~page_arena() {
+                for (void* slab : __slabs) {
+                        munmap(slab, ARENA_SLAB);
+                }
+        }
+
+        // 分配至少size字节，返回实际可用的容量
+        void* allocate(size_t size, size_t& capacity);
+        void deallocate(void* ptr, size_t capacity) noexcept;
+
+        size_t mapped() const noexcept {
+                return __mapped;
+        }
+private:
+        struct free_block {
+                free_block* next;
+        };
+
+        free_block* __free[ARENA_CLASSES] {};
+        char* __cursor {nullptr};
+        char* __end {nullptr};
+        size_t __mapped {0};
+        std::vector<void*> __slabs;
+
+        static size_t class_of(size_t size) noexcept {
+                size_t c = 0;
+                while (c < ARENA_CLASSES && ((size_t)1 << (c + ARENA_MIN_SHIFT)) < size) c++;
+                return c;
+        }
+        static size_t page_round(size_t size) noexcept {
+                return (size + BASE_ALLOCATOR_UNIT - 1) / BASE_ALLOCATOR_UNIT * BASE_ALLOCATOR_UNIT;
+        }
+};
+
+inline void* page_arena::allocate(size_t size, size_t& capacity) {
+        size_t c = class_of(size);
+        if (c == ARENA_CLASSES) {
+                capacity = page_round(size);
+                void* mem = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (mem == MAP_FAILED) {
+                        throw std::bad_alloc();
+                }
+                __mapped += capacity;
+                return mem;
+        }
+
+        capacity = (size_t)1 << (c + ARENA_MIN_SHIFT);
+        if (__free[c] != nullptr) {
+                free_block* block = __free[c];
+                __free[c] = block->next;
+                return block;
+        }
+
+        if (__cursor == nullptr || (size_t)(__end - __cursor) < capacity) {
+                void* mem = mmap(NULL, ARENA_SLAB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (mem == MAP_FAILED) {
+                        throw std::bad_alloc();
+                }
+                try {
+                        __slabs.push_back(mem);
+                } catch (...) {
+                        munmap(mem, ARENA_SLAB);
+                        throw;
+                }
+                __cursor = static_cast<char*>(mem);
+                __end = __cursor + ARENA_SLAB;
+                __mapped += ARENA_SLAB;
+        }
+
+        void* ret = __cursor;
+        __cursor += capacity;
+        return ret;
+}
+
+inline void page_arena::deallocate(void* ptr, size_t capacity) noexcept {
+        size_t c = class_of(capacity);
+        if (c == ARENA_CLASSES) {
+                munmap(ptr, capacity);
+                __mapped -= capacity;
+                return;
+        }
+
+        auto block = static_cast<free_block*>(ptr);
+        block->next = __free[c];
+        __free[c] = block;
+}
+
+
+#pragma region shard_store
+
+class shard_store {
+public:
+        static std::unique_ptr<shard_store> new_store() {
+                return std::unique_ptr<shard_store>(new shard_store());
+        }
+
+        shard_store(const shard_store&) = delete;
+        shard_store& operator=(const shard_store&) = delete;
+
+        ~shard_store();
+
+        // 返回的value在下一次修改该key之前有效
+        bool get(std::string_view key, std::string_view& value) const noexcept;
+        void put(std::string_view key, std::string_view value);
+        bool remove(std::string_view key) noexcept;
+
+        size_t size() const noexcept {
+                return __index.size();
+        }
+        size_t mapped() const noexcept {
+                return __arena.mapped();
+        }
+private:
+        // 条目布局: entry | key | value
+        struct entry {
+                uint32_t capacity;
+                uint16_t key_len;
+                uint16_t reserved;
+                uint32_t value_len;
+
+                char* key() noexcept {
+                        return reinterpret_cast<char*>(this + 1);
+                }
+                char* value() noexcept {
+                        return key() + key_len;
+                }
+        };
+
+        page_arena __arena;
+        // key指向条目内部
+        std::unordered_map<std::string_view, entry*> __index;
+
+        shard_store() noexcept {}
+
+        entry* new_entry(std::string_view key, std::string_view value);
+};
+
+inline shard_store::~shard_store() {
+        // slab随__arena析构释放，这里只释放单独映射的大条目
+        for (auto &kv : __index) {
+                __arena.deallocate(kv.second, kv.second->capacity);
+        }
+}
+
+inline shard_store::entry* shard_store::new_entry(std::string_view key, std::string_view value) {
+        size_t capacity = 0;
+        auto e = static_cast<entry*>(__arena.allocate(sizeof(entry) + key.size() + value.size(), capacity));
+        e->capacity = static_cast<uint32_t>(capacity);
+        e->key_len = static_cast<uint16_t>(key.size());
+        e->value_len = static_cast<uint32_t>(value.size());
+        // 空的string_view的data()可以是nullptr，不能传给memcpy
+        if (!key.empty()) memcpy(e->key(), key.data(), key.size());
+        if (!value.empty()) memcpy(e->value(), value.data(), value.size());
+        return e;
+}
+
+inline bool shard_store::get(std::string_view key, std::string_view& value) const noexcept {
+        auto iter = __index.find(key);
+        if (iter == __index.end()) return false;
+
+        entry* e = iter->second;
+        value = std::string_view(e->value(), e->value_len);
+        return true;
+}
+
+// 先分配新条目再替换，分配或插入索引失败时原来的值不变
+inline void shard_store::put(std::string_view key, std::string_view value) {
+        auto iter = __index.find(key);
+        if (iter != __index.end()) {
+                entry* old = iter->second;
+                // 容量足够时原地覆盖，索引中的key不变
+                if (sizeof(entry) + key.size() + value.size() <= old->capacity) {
+                        if (!value.empty()) memcpy(old->value(), value.data(), value.size());
+                        old->value_len = static_cast<uint32_t>(value.size());
+                        return;
+                }
+
+                entry* e = new_entry(key, value);
+                // 索引中的key指向旧条目，取出节点改为指向新条目，不重新分配节点
+                auto node = __index.extract(iter);
+                node.key() = std::string_view(e->key(), e->key_len);
+                node.mapped() = e;
+                __index.insert(std::move(node));
+                __arena.deallocate(old, old->capacity);
+                return;
+        }
+
+        entry* e = new_entry(key, value);
+        try {
+                __index.emplace(std::string_view(e->key(), e->key_len), e);
+        } catch (...) {
+                __arena.deallocate(e, e->capacity);
+                throw;
+        }
+}
+
+inline bool shard_store::remove(std::string_view key) noexcept {
+        auto iter = __index.find(key);
+        if (iter == __index.end()) return false;
+
+        entry* e = iter->second;
+        __index.erase(iter);
+        __arena.deallocate(e, e->capacity);
+        return true;
+}
+
+#endif
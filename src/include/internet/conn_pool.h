@@ -0,0 +1,328 @@
+/**
+ * 按环路由的连接池
+ *
+ * 每个线程持有自己的连接池，acquire时只读一次全局epoch，
+ * 路由与取连接都在线程本地完成；只有环发生变化后的第一次acquire才加锁同步。
+ * 需要新建连接时acquire在调用线程上阻塞connect，不加锁也不影响其他线程。
+ */
+
+#include <atomic>
+#include <concepts>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "internet.h"
+#include "connection.h"
+#include "port_allocator.h"
+
+#ifndef __Z_CONN_POOL
+#define __Z_CONN_POOL
+
+#pragma region Exceptions
+
+class ConnectionPoolException : public std::exception {
+public:
+        explicit ConnectionPoolException(const std::string& msg) : __msg(msg) {}
+
+        const char* what() const noexcept override {
+                return __msg.c_str();
+        }
+private:
+        std::string __msg;
+};
+
+
+#pragma region Thread Index
+
+// 线程退出后归还编号，使线程槽位数量只与并发线程数有关
+class __pool_thread_id {
+public:
+        __pool_thread_id() {
+                std::lock_guard<std::mutex> guard(lock());
+                auto& fl = free_list();
+                if (fl.empty()) {
+                        id = next()++;
+                } else {
+                        id = fl.back();
+                        fl.pop_back();
+                }
+        }
+        ~__pool_thread_id() {
+                std::lock_guard<std::mutex> guard(lock());
+                free_list().push_back(id);
+        }
+
+        size_t id;
+private:
+        static std::mutex& lock() noexcept {
+                static std::mutex m;
+                return m;
+        }
+        static std::vector<size_t>& free_list() noexcept {
+                static std::vector<size_t> fl;
+                return fl;
+        }
+        static size_t& next() noexcept {
+                static size_t n = 0;
+                return n;
+        }
+};
+
+inline size_t pool_thread_index() noexcept {
+        thread_local __pool_thread_id tid;
+        return tid.id;
+}
+
+
+#pragma region routed_pool
+
+template <typename Ring>
+concept RouteRing = requires(const Ring& __ring, size_t __index) {
+        { __ring.capacity() } -> std::convertible_to<size_t>;
+        { __ring.access(__index) } -> std::convertible_to<const ipv4&>;
+};
+
+constexpr size_t DEFAULT_POOL_THREADS = 256;
+constexpr size_t DEFAULT_CONNS_PER_NODE = 4;
+// 单个连接上允许同时在途的请求数，超过后优先新建连接
+constexpr size_t DEFAULT_PIPELINE_DEPTH = 16;
+// 离开环的节点记录，落后更多的线程直接清空自己的连接池
+constexpr size_t DEFAULT_DEPARTURE_LOG = 4096;
+
+/**
+ * Ring: zcycle<ipv4, ...> 或任何满足RouteRing的环
+ * lease只能在获取它的线程中使用与释放
+ */
+template <RouteRing Ring>
+class routed_pool {
+        struct pooled {
+                std::unique_ptr<tcp_connection> conn;
+                size_t inflight {0};
+        };
+
+        struct alignas(64) local_pool {
+                uint64_t epoch {0};
+                std::shared_ptr<const Ring> ring;
+                // endpoint key -> 该节点上的连接
+                std::unordered_map<uint64_t, std::vector<std::unique_ptr<pooled>>> nodes;
+                // 节点已离开，等在途请求结束后关闭
+                std::vector<std::unique_ptr<pooled>> draining;
+        };
+public:
+        class lease {
+        public:
+                lease(const lease&) = delete;
+                lease& operator=(const lease&) = delete;
+                lease(lease&& other) noexcept : __item(other.__item) {
+                        other.__item = nullptr;
+                }
+                lease& operator=(lease&& other) noexcept {
+                        if (this != &other) {
+                                release();
+                                __item = other.__item;
+                                other.__item = nullptr;
+                        }
+                        return *this;
+                }
+                ~lease() {
+                        release();
+                }
+
+                tcp_connection& connection() const noexcept {
+                        return *__item->conn;
+                }
+                // 连接出错，不再分配给后续请求
+                void fail() noexcept {
+                        __item->conn->mark_broken();
+                }
+        private:
+                pooled* __item;
+
+                explicit lease(pooled* item) noexcept : __item(item) {
+                        __item->inflight++;
+                }
+                void release() noexcept {
+                        if (__item != nullptr) {
+                                __item->inflight--;
+                                __item = nullptr;
+                        }
+                }
+
+                friend routed_pool;
+        };
+
+        // ports不为空时新连接从中分配本地端口，见port_allocator.h
+        static std::unique_ptr<routed_pool> new_with_ring(
+                std::shared_ptr<const Ring> ring,
+                size_t conns_per_node = DEFAULT_CONNS_PER_NODE,
+                size_t pipeline_depth = DEFAULT_PIPELINE_DEPTH,
+                size_t max_threads = DEFAULT_POOL_THREADS,
+                std::shared_ptr<port_allocator> ports = nullptr
+        );
+
+        routed_pool(const routed_pool&) = delete;
+        routed_pool& operator=(const routed_pool&) = delete;
+
+        // 路由key_hash到节点并取得一个连接，环未变化时不加锁；
+        // 没有可用连接或都已满时阻塞connect新连接，失败抛出ConnectionException
+        lease acquire(uint32_t key_hash);
+        // 发布新的环，departed中节点的连接在各线程下一次acquire时drain并驱逐
+        void publish(std::shared_ptr<const Ring> ring, const std::vector<ipv4>& departed);
+
+        uint64_t epoch() const noexcept {
+                return __epoch.load(std::memory_order_acquire);
+        }
+private:
+        const size_t __conns_per_node, __pipeline_depth, __max_threads;
+        std::unique_ptr<local_pool[]> __locals;
+        const std::shared_ptr<port_allocator> __ports;
+
+        std::atomic<uint64_t> __epoch {1};
+
+        // 以下只在慢路径中使用
+        std::mutex __mutex;
+        std::shared_ptr<const Ring> __ring;
+        std::deque<std::pair<uint64_t, uint64_t>> __departures;
+        // 小于该epoch的线程缺少被裁掉的离开记录
+        uint64_t __departure_floor {0};
+
+        routed_pool(std::shared_ptr<const Ring> ring, size_t conns, size_t depth, size_t threads, std::shared_ptr<port_allocator> ports)
+        : __conns_per_node(conns), __pipeline_depth(depth), __max_threads(threads),
+          __locals(new local_pool[threads]), __ports(std::move(ports)), __ring(std::move(ring)) {}
+
+        static uint64_t endpoint_key(const ipv4& ip) noexcept {
+                return (static_cast<uint64_t>(ip.addr()) << 16) | ip.port();
+        }
+
+        void refresh(local_pool& local);
+        void drain(local_pool& local, uint64_t key);
+        static void sweep(local_pool& local) noexcept;
+};
+
+template <RouteRing Ring>
+inline std::unique_ptr<routed_pool<Ring>> routed_pool<Ring>::new_with_ring(
+        std::shared_ptr<const Ring> ring, size_t conns_per_node, size_t pipeline_depth, size_t max_threads,
+        std::shared_ptr<port_allocator> ports
+) {
+        if (ring == nullptr) {
+                throw ConnectionPoolException("routed_pool needs a ring");
+        }
+        return std::unique_ptr<routed_pool>(new routed_pool(
+                std::move(ring), std::max(conns_per_node, (size_t)1), std::max(pipeline_depth, (size_t)1), max_threads, std::move(ports)
+        ));
+}
+
+template <RouteRing Ring>
+inline typename routed_pool<Ring>::lease routed_pool<Ring>::acquire(uint32_t key_hash) {
+        size_t tid = pool_thread_index();
+        if (tid >= __max_threads) {
+                throw ConnectionPoolException("too many threads for routed_pool (max " + std::to_string(__max_threads) + ")");
+        }
+
+        local_pool& local = __locals[tid];
+        if (local.epoch != __epoch.load(std::memory_order_acquire)) {
+                refresh(local);
+        }
+        if (!local.draining.empty()) {
+                sweep(local);
+        }
+
+        const Ring& ring = *local.ring;
+        const ipv4& ep = ring.access(key_hash % ring.capacity());
+        auto& conns = local.nodes[endpoint_key(ep)];
+
+        // 选在途请求最少的可用连接，顺便清理已经断开且空闲的连接；
+        // 断开但仍有在途请求的连接不计入conns_per_node
+        pooled* best = nullptr;
+        size_t alive = 0;
+        for (size_t i = 0; i < conns.size(); ) {
+                pooled* p = conns[i].get();
+                if (!p->conn->alive()) {
+                        if (p->inflight == 0) {
+                                conns[i] = std::move(conns.back());
+                                conns.pop_back();
+                                continue;
+                        }
+                } else {
+                        alive++;
+                        if (best == nullptr || p->inflight < best->inflight) best = p;
+                }
+                ++i;
+        }
+
+        if (best == nullptr || (best->inflight >= __pipeline_depth && alive < __conns_per_node)) {
+                auto item = std::make_unique<pooled>();
+                item->conn = tcp_connection::new_with_allocator(ep, __ports);
+                best = item.get();
+                conns.push_back(std::move(item));
+        }
+
+        return lease(best);
+}
+
+template <RouteRing Ring>
+inline void routed_pool<Ring>::publish(std::shared_ptr<const Ring> ring, const std::vector<ipv4>& departed) {
+        if (ring == nullptr) {
+                throw ConnectionPoolException("routed_pool needs a ring");
+        }
+
+        std::lock_guard<std::mutex> guard(__mutex);
+        uint64_t next = __epoch.load(std::memory_order_relaxed) + 1;
+
+        __ring = std::move(ring);
+        for (auto &ip : departed) {
+                __departures.emplace_back(next, endpoint_key(ip));
+        }
+        while (__departures.size() > DEFAULT_DEPARTURE_LOG) {
+                __departure_floor = __departures.front().first;
+                __departures.pop_front();
+        }
+
+        __epoch.store(next, std::memory_order_release);
+}
+
+// 慢路径: 环变化后线程第一次acquire
+template <RouteRing Ring>
+inline void routed_pool<Ring>::refresh(local_pool& local) {
+        std::lock_guard<std::mutex> guard(__mutex);
+
+        if (local.epoch < __departure_floor) {
+                std::vector<uint64_t> keys;
+                keys.reserve(local.nodes.size());
+                for (auto &node : local.nodes) keys.push_back(node.first);
+                for (auto key : keys) drain(local, key);
+        } else {
+                for (auto &dep : __departures) {
+                        if (dep.first > local.epoch) drain(local, dep.second);
+                }
+        }
+
+        local.ring = __ring;
+        local.epoch = __epoch.load(std::memory_order_relaxed);
+}
+
+template <RouteRing Ring>
+inline void routed_pool<Ring>::drain(local_pool& local, uint64_t key) {
+        auto iter = local.nodes.find(key);
+        if (iter == local.nodes.end()) return;
+
+        for (auto &item : iter->second) {
+                if (item->inflight > 0) {
+                        local.draining.push_back(std::move(item));
+                }
+                // 空闲连接随unique_ptr直接关闭
+        }
+        local.nodes.erase(iter);
+}
+
+template <RouteRing Ring>
+inline void routed_pool<Ring>::sweep(local_pool& local) noexcept {
+        std::erase_if(local.draining, [](const std::unique_ptr<pooled>& p) { return p->inflight == 0; });
+}
+
+#endif
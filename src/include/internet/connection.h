@@ -0,0 +1,174 @@
+/**
+ * TCP连接，持有fd与对端ipv4
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <exception>
+#include <memory>
+#include <string>
+
+#include "internet.h"
+#include "port_allocator.h"
+
+#ifndef __Z_CONNECTION
+#define __Z_CONNECTION
+
+#pragma region Exceptions
+
+class ConnectionException : public std::exception {
+public:
+        ConnectionException(const std::string& op, int err)
+        : __msg(op + " failed: " + std::string(strerror(err))), __err(err) {}
+
+        const char* what() const noexcept override {
+                return __msg.c_str();
+        }
+        int error() const noexcept {
+                return __err;
+        }
+private:
+        std::string __msg;
+        int __err;
+};
+
+
+#pragma region tcp_connection
+
+inline sockaddr_in to_sockaddr(const ipv4& ip) noexcept {
+        sockaddr_in sa {};
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(ip.addr());
+        sa.sin_port = htons(ip.port());
+        return sa;
+}
+
+// 分配到的本地端口已被占用时换一个端口重试的次数
+constexpr size_t LOCAL_PORT_ATTEMPTS = 8;
+
+class tcp_connection {
+public:
+        // 阻塞connect到endpoint，成功后设置TCP_NODELAY
+        // local_port非0时先以SO_REUSEADDR绑定，同一本地端口可以连向不同的目的地址
+        static std::unique_ptr<tcp_connection> new_with_endpoint(const ipv4&, port_t local_port = 0);
+        // 从ports为endpoint分配本地端口后连接，连接析构时归还
+        static std::unique_ptr<tcp_connection> new_with_allocator(const ipv4&, std::shared_ptr<port_allocator> ports);
+        // 接管已经建立的fd(例如accept得到的)
+        static std::unique_ptr<tcp_connection> new_with_fd(int fd, const ipv4&) noexcept;
+
+        tcp_connection(const tcp_connection&) = delete;
+        tcp_connection& operator=(const tcp_connection&) = delete;
+
+        virtual ~tcp_connection() {
+                if (__fd >= 0) close(__fd);
+                if (__ports != nullptr) __ports->release(__endpoint, __local_port);
+        }
+
+        int fd() const noexcept {
+                return __fd;
+        }
+        const ipv4& endpoint() const noexcept {
+                return __endpoint;
+        }
+
+        // 读写出错后标记，不再复用
+        bool alive() const noexcept {
+                return !__broken;
+        }
+        void mark_broken() noexcept {
+                __broken = true;
+        }
+
+        void set_nonblocking(bool on) const;
+private:
+        int __fd {-1};
+        ipv4 __endpoint;
+        bool __broken {false};
+        std::shared_ptr<port_allocator> __ports;
+        port_t __local_port {0};
+
+        tcp_connection(int fd, const ipv4& endpoint) noexcept : __fd(fd), __endpoint(endpoint) {}
+};
+
+inline std::unique_ptr<tcp_connection> tcp_connection::new_with_endpoint(const ipv4& endpoint, port_t local_port) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+                throw ConnectionException("socket", errno);
+        }
+
+        if (local_port != 0) {
+                int one = 1;
+                sockaddr_in local {};
+                local.sin_family = AF_INET;
+                local.sin_addr.s_addr = htonl(INADDR_ANY);
+                local.sin_port = htons(local_port);
+                if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+                 || bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) < 0) {
+                        int err = errno;
+                        close(fd);
+                        throw ConnectionException("bind local port " + std::to_string(local_port), err);
+                }
+        }
+
+        sockaddr_in sa = to_sockaddr(endpoint);
+        while (connect(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) < 0) {
+                if (errno == EINTR) continue;
+                int err = errno;
+                close(fd);
+                throw ConnectionException("connect to " + std::string(endpoint), err);
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        return std::unique_ptr<tcp_connection>(new tcp_connection(fd, endpoint));
+}
+
+inline std::unique_ptr<tcp_connection> tcp_connection::new_with_allocator(const ipv4& endpoint, std::shared_ptr<port_allocator> ports) {
+        if (ports == nullptr) {
+                return new_with_endpoint(endpoint);
+        }
+
+        for (size_t attempt = 0; ; ++attempt) {
+                port_t port = ports->acquire(endpoint);
+                if (port == 0) {
+                        throw ConnectionException("allocate local port for " + std::string(endpoint), EADDRNOTAVAIL);
+                }
+
+                try {
+                        auto conn = new_with_endpoint(endpoint, port);
+                        conn->__ports = std::move(ports);
+                        conn->__local_port = port;
+                        return conn;
+                } catch (const ConnectionException& e) {
+                        // 端口被其他socket占用(例如不带SO_REUSEADDR的绑定)时换一个，其他错误直接抛出
+                        ports->release(endpoint, port);
+                        bool in_use = e.error() == EADDRINUSE || e.error() == EADDRNOTAVAIL;
+                        if (!in_use || attempt + 1 >= LOCAL_PORT_ATTEMPTS) throw;
+                }
+        }
+}
+
+inline std::unique_ptr<tcp_connection> tcp_connection::new_with_fd(int fd, const ipv4& endpoint) noexcept {
+        return std::unique_ptr<tcp_connection>(new tcp_connection(fd, endpoint));
+}
+
+inline void tcp_connection::set_nonblocking(bool on) const {
+        int flags = fcntl(__fd, F_GETFL, 0);
+        if (flags < 0) {
+                throw ConnectionException("fcntl", errno);
+        }
+        flags = on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+        if (fcntl(__fd, F_SETFL, flags) < 0) {
+                throw ConnectionException("fcntl", errno);
+        }
+}
+
+#endif
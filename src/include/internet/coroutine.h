@@ -0,0 +1,647 @@
+/**
+ * 基于event_loop的C++20协程接口
+ *
+ * task<T>: 惰性启动，co_await时对称转移到被等待的协程
+ * scheduler: 每个线程(核)一个，就绪的协程攒成一批统一恢复；spawn出的协程在它停止后可以统一销毁
+ * async_socket / async_listener: 非阻塞fd上的accept/read/write/connect
+ * sleep_for: 定时器节点放在协程帧中，不额外分配
+ *
+ * 协程帧从线程本地的frame_pool分配，按页映射、按大小分级复用，不经过全局堆。
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "internet.h"
+#include "connection.h"
+#include "event_loop.h"
+#include "../storage/zstorage.h"
+
+#ifndef __Z_COROUTINE
+#define __Z_COROUTINE
+
+#pragma region frame_pool
+
+// 协程帧按2的幂分级: 64 ~ 4096字节，更大的走全局堆
+constexpr size_t FRAME_POOL_MIN_SHIFT = 6;
+constexpr size_t FRAME_POOL_CLASSES = 7;
+constexpr size_t FRAME_POOL_SLAB = BASE_ALLOCATOR_UNIT * 16;
+
+class frame_pool {
+public:
+        // 当前线程的池；线程退出后slab不归还，协程帧可以在其他线程释放
+        static frame_pool& local() noexcept {
+                thread_local frame_pool pool;
+                return pool;
+        }
+
+        frame_pool(const frame_pool&) = delete;
+        frame_pool& operator=(const frame_pool&) = delete;
+
+        void* allocate(size_t size);
+        void deallocate(void* ptr, size_t size) noexcept;
+
+        // 已经映射的slab总字节数
+        size_t mapped() const noexcept {
+                return __mapped;
+        }
+private:
+        struct free_block {
+                free_block* next;
+        };
+
+        free_block* __free[FRAME_POOL_CLASSES] {};
+        char* __cursor {nullptr};
+        char* __end {nullptr};
+        size_t __mapped {0};
+
+        frame_pool() noexcept {}
+
+        static size_t class_of(size_t size) noexcept {
+                size_t c = 0;
+                while (c < FRAME_POOL_CLASSES && ((size_t)1 << (c + FRAME_POOL_MIN_SHIFT)) < size) c++;
+                return c;
+        }
+};
+
+inline void* frame_pool::allocate(size_t size) {
+        size_t c = class_of(size);
+        if (c == FRAME_POOL_CLASSES) {
+                return ::operator new(size);
+        }
+
+        if (__free[c] != nullptr) {
+                free_block* block = __free[c];
+                __free[c] = block->next;
+                return block;
+        }
+
+        size_t bytes = (size_t)1 << (c + FRAME_POOL_MIN_SHIFT);
+        if (__cursor == nullptr || (size_t)(__end - __cursor) < bytes) {
+                // 剩余的尾部直接丢弃，slab足够大，浪费可以忽略
+                void* mem = mmap(NULL, FRAME_POOL_SLAB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (mem == MAP_FAILED) {
+                        throw std::bad_alloc();
+                }
+                __cursor = static_cast<char*>(mem);
+                __end = __cursor + FRAME_POOL_SLAB;
+                __mapped += FRAME_POOL_SLAB;
+        }
+
+        void* ret = __cursor;
+        __cursor += bytes;
+        return ret;
+}
+
+inline void frame_pool::deallocate(void* ptr, size_t size) noexcept {
+        size_t c = class_of(size);
+        if (c == FRAME_POOL_CLASSES) {
+                ::operator delete(ptr);
+                return;
+        }
+
+        auto block = static_cast<free_block*>(ptr);
+        block->next = __free[c];
+        __free[c] = block;
+}
+
+// 所有promise的基类，协程帧由frame_pool分配
+struct __pooled_frame {
+        static void* operator new(size_t size) {
+                return frame_pool::local().allocate(size);
+        }
+        static void operator delete(void* ptr, size_t size) noexcept {
+                frame_pool::local().deallocate(ptr, size);
+        }
+};
+
+
+#pragma region task
+
+template <typename T = void>
+class task;
+
+struct __promise_base : __pooled_frame {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr exception;
+
+        std::suspend_always initial_suspend() noexcept {
+                return {};
+        }
+
+        // 结束时对称转移回等待者，没有等待者时停在终点，由task析构
+        struct final_awaiter {
+                bool await_ready() const noexcept {
+                        return false;
+                }
+                template <typename P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+                        auto next = h.promise().continuation;
+                        return next ? next : std::noop_coroutine();
+                }
+                void await_resume() const noexcept {}
+        };
+        final_awaiter final_suspend() noexcept {
+                return {};
+        }
+
+        void unhandled_exception() noexcept {
+                exception = std::current_exception();
+        }
+};
+
+template <typename T>
+struct __task_promise : __promise_base {
+        std::optional<T> value;
+
+        void return_value(T v) {
+                value.emplace(std::move(v));
+        }
+        T result() {
+                if (exception) std::rethrow_exception(exception);
+                return std::move(*value);
+        }
+};
+
+template <>
+struct __task_promise<void> : __promise_base {
+        void return_void() noexcept {}
+        void result() {
+                if (exception) std::rethrow_exception(exception);
+        }
+};
+
+template <typename T>
+class task {
+public:
+        struct promise_type : __task_promise<T> {
+                task get_return_object() noexcept {
+                        return task(std::coroutine_handle<promise_type>::from_promise(*this));
+                }
+        };
+
+        task(const task&) = delete;
+        task& operator=(const task&) = delete;
+        task(task&& other) noexcept : __handle(std::exchange(other.__handle, nullptr)) {}
+        task& operator=(task&& other) noexcept {
+                if (this != &other) {
+                        if (__handle) __handle.destroy();
+                        __handle = std::exchange(other.__handle, nullptr);
+                }
+                return *this;
+        }
+        ~task() {
+                if (__handle) __handle.destroy();
+        }
+
+        struct awaiter {
+                std::coroutine_handle<promise_type> handle;
+
+                bool await_ready() const noexcept {
+                        return handle.done();
+                }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiting) noexcept {
+                        handle.promise().continuation = waiting;
+                        return handle;
+                }
+                T await_resume() {
+                        return handle.promise().result();
+                }
+        };
+        // 被移走的task没有协程帧，等待它是调用方的错误
+        awaiter operator co_await() const {
+                if (!__handle) {
+                        throw std::logic_error("co_await on an empty task");
+                }
+                return awaiter { __handle };
+        }
+private:
+        std::coroutine_handle<promise_type> __handle;
+
+        explicit task(std::coroutine_handle<promise_type> h) noexcept : __handle(h) {}
+};
+
+
+#pragma region scheduler
+
+struct __detached_promise;
+
+class scheduler {
+public:
+        static std::unique_ptr<scheduler> new_scheduler(uint64_t tick_us = DEFAULT_TICK_US) {
+                return std::unique_ptr<scheduler>(new scheduler(event_loop::new_loop(tick_us)));
+        }
+        // 当前线程正在run()的scheduler
+        static scheduler* current() noexcept {
+                return __current();
+        }
+        // 把当前线程绑定到cpu上，每个核运行一个scheduler
+        static void pin_current_thread(int cpu);
+
+        scheduler(const scheduler&) = delete;
+        scheduler& operator=(const scheduler&) = delete;
+
+        ~scheduler() {
+                destroy_spawned();
+        }
+
+        event_loop& loop() noexcept {
+                return *__loop;
+        }
+
+        // 启动一个独立运行的协程，异常打印后丢弃
+        void spawn(task<void>&& t);
+        /**
+         * 销毁所有尚未结束的spawn协程及其正在等待的子协程，帧中的socket随之关闭
+         * 只能在run()之外调用；直接post而不属于spawn协程的句柄一并丢弃
+         */
+        void destroy_spawned() noexcept;
+        // 在下一批中恢复h，只能在本线程调用
+        void post(std::coroutine_handle<> h) {
+                __ready.push_back(h);
+        }
+
+        // 恢复一批就绪协程，返回数量
+        size_t run_ready();
+        void run();
+        // 可以从其他线程调用
+        void stop() noexcept {
+                __stop.store(true, std::memory_order_release);
+                __loop->wake();
+        }
+private:
+        std::unique_ptr<event_loop> __loop;
+        std::vector<std::coroutine_handle<>> __ready, __batch;
+        std::atomic<bool> __stop {false};
+        // 尚未结束的spawn协程，侵入式双向链表
+        __detached_promise* __spawned {nullptr};
+
+        explicit scheduler(std::unique_ptr<event_loop> loop) noexcept : __loop(std::move(loop)) {}
+
+        static scheduler*& __current() noexcept {
+                thread_local scheduler* cur = nullptr;
+                return cur;
+        }
+
+        friend __detached_promise;
+};
+
+struct __detached;
+
+// spawn使用的顶层协程，结束后自行销毁并从scheduler的链表中摘除
+struct __detached_promise : __pooled_frame {
+        scheduler* owner {nullptr};
+        __detached_promise* prev {nullptr};
+        __detached_promise* next {nullptr};
+
+        ~__detached_promise() {
+                if (owner == nullptr) return;
+                if (prev != nullptr) prev->next = next;
+                else owner->__spawned = next;
+                if (next != nullptr) next->prev = prev;
+        }
+
+        __detached get_return_object() noexcept;
+        std::suspend_always initial_suspend() noexcept {
+                return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+                return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {
+                try {
+                        throw;
+                } catch (const std::exception& e) {
+                        fprintf(stderr, "spawned coroutine failed: %s\n", e.what());
+                } catch (...) {
+                        fprintf(stderr, "spawned coroutine failed.\n");
+                }
+        }
+};
+
+struct __detached {
+        using promise_type = __detached_promise;
+        std::coroutine_handle<promise_type> handle;
+};
+
+inline __detached __detached_promise::get_return_object() noexcept {
+        return { std::coroutine_handle<__detached_promise>::from_promise(*this) };
+}
+
+inline __detached __run_detached(task<void> t) {
+        co_await t;
+}
+
+inline void scheduler::spawn(task<void>&& t) {
+        auto h = __run_detached(std::move(t)).handle;
+        auto& p = h.promise();
+        p.owner = this;
+        p.next = __spawned;
+        if (__spawned != nullptr) __spawned->prev = &p;
+        __spawned = &p;
+        post(h);
+}
+
+inline void scheduler::destroy_spawned() noexcept {
+        // 就绪队列中可能是即将被销毁的帧
+        __ready.clear();
+        while (__spawned != nullptr) {
+                // 析构promise时从链表中摘除
+                std::coroutine_handle<__detached_promise>::from_promise(*__spawned).destroy();
+        }
+}
+
+inline size_t scheduler::run_ready() {
+        // 恢复过程中新就绪的协程进入下一批
+        __batch.swap(__ready);
+        size_t n = __batch.size();
+        for (auto h : __batch) {
+                h.resume();
+        }
+        __batch.clear();
+        return n;
+}
+
+inline void scheduler::run() {
+        scheduler* prev = __current();
+        __current() = this;
+        while (!__stop.load(std::memory_order_acquire)) {
+                run_ready();
+                if (__stop.load(std::memory_order_acquire)) break;
+                // 还有就绪协程时只收集IO事件，不阻塞
+                __loop->run_once(__ready.empty() ? -1 : 0);
+        }
+        __stop.store(false, std::memory_order_relaxed);
+        __current() = prev;
+}
+
+inline void scheduler::pin_current_thread(int cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+                throw EventLoopException("pthread_setaffinity_np", err);
+        }
+}
+
+
+#pragma region sleep_for
+
+struct sleep_awaiter {
+        scheduler* sched;
+        uint64_t ticks;
+        timer_node node;
+        std::coroutine_handle<> waiting;
+
+        sleep_awaiter(scheduler* s, uint64_t t) noexcept : sched(s), ticks(t) {}
+
+        bool await_ready() const noexcept {
+                return ticks == 0;
+        }
+        void await_suspend(std::coroutine_handle<> h) noexcept {
+                waiting = h;
+                node.data = this;
+                node.callback = [](timer_node* n) {
+                        auto self = static_cast<sleep_awaiter*>(n->data);
+                        self->sched->post(self->waiting);
+                };
+                sched->loop().timers().schedule(node, ticks);
+        }
+        void await_resume() const noexcept {}
+};
+
+// 只能在scheduler::run()中的协程里使用
+inline sleep_awaiter sleep_for(uint64_t ms) {
+        scheduler* s = scheduler::current();
+        return sleep_awaiter(s, ms == 0 ? 0 : s->loop().ticks_of_ms(ms));
+}
+
+
+#pragma region async_socket
+
+// 边沿触发注册一次，读写各自最多一个等待者
+struct __async_fd {
+        int fd {-1};
+        scheduler* sched {nullptr};
+        io_watch watch;
+        std::coroutine_handle<> reader, writer;
+
+        // 接管fd，包括分配与注册失败时关闭它
+        static std::unique_ptr<__async_fd> new_with_fd(scheduler& s, int fd) {
+                try {
+                        return std::unique_ptr<__async_fd>(new __async_fd(s, fd));
+                } catch (...) {
+                        close(fd);
+                        throw;
+                }
+        }
+        ~__async_fd() {
+                sched->loop().unwatch(watch);
+                close(fd);
+        }
+private:
+        // 失败时不关闭fd，由new_with_fd关闭
+        __async_fd(scheduler& s, int f) : fd(f), sched(&s) {
+                int flags = fcntl(fd, F_GETFL, 0);
+                if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+                        throw ConnectionException("fcntl", errno);
+                }
+
+                watch.fd = fd;
+                watch.data = this;
+                watch.callback = [](io_watch* w, uint32_t events) {
+                        auto self = static_cast<__async_fd*>(w->data);
+                        if (self->reader && (events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP))) {
+                                self->sched->post(std::exchange(self->reader, nullptr));
+                        }
+                        if (self->writer && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                                self->sched->post(std::exchange(self->writer, nullptr));
+                        }
+                };
+                sched->loop().watch(watch, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        }
+public:
+        struct readiness {
+                std::coroutine_handle<>* slot;
+
+                bool await_ready() const noexcept {
+                        return false;
+                }
+                void await_suspend(std::coroutine_handle<> h) noexcept {
+                        *slot = h;
+                }
+                void await_resume() const noexcept {}
+        };
+        readiness readable() noexcept {
+                return { &reader };
+        }
+        readiness writable() noexcept {
+                return { &writer };
+        }
+};
+
+class async_socket {
+public:
+        // 接管fd，设置为非阻塞并注册到s的event_loop；失败时fd被关闭
+        static async_socket new_with_fd(scheduler& s, int fd) {
+                return async_socket(__async_fd::new_with_fd(s, fd));
+        }
+        static task<async_socket> connect(scheduler& s, ipv4 endpoint);
+
+        async_socket(async_socket&&) = default;
+        async_socket& operator=(async_socket&&) = default;
+
+        int fd() const noexcept {
+                return __state->fd;
+        }
+
+        // 读到至少一个字节后返回，对端关闭时返回0
+        task<size_t> read(void* buf, size_t len);
+        // 写出全部字节
+        task<size_t> write(const void* buf, size_t len);
+private:
+        // io_watch的地址注册在epoll中，必须稳定
+        std::unique_ptr<__async_fd> __state;
+
+        explicit async_socket(std::unique_ptr<__async_fd> state) noexcept : __state(std::move(state)) {}
+};
+
+inline task<size_t> async_socket::read(void* buf, size_t len) {
+        __async_fd* s = __state.get();
+        for (;;) {
+                ssize_t n = ::read(s->fd, buf, len);
+                if (n >= 0) co_return (size_t)n;
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        throw ConnectionException("read", errno);
+                }
+                co_await s->readable();
+        }
+}
+
+inline task<size_t> async_socket::write(const void* buf, size_t len) {
+        __async_fd* s = __state.get();
+        size_t sent = 0;
+        while (sent < len) {
+                ssize_t n = ::send(s->fd, static_cast<const char*>(buf) + sent, len - sent, MSG_NOSIGNAL);
+                if (n >= 0) {
+                        sent += n;
+                        continue;
+                }
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        throw ConnectionException("send", errno);
+                }
+                co_await s->writable();
+        }
+        co_return sent;
+}
+
+inline task<async_socket> async_socket::connect(scheduler& s, ipv4 endpoint) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+                throw ConnectionException("socket", errno);
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        auto state = __async_fd::new_with_fd(s, fd);
+        sockaddr_in sa = to_sockaddr(endpoint);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) < 0) {
+                if (errno != EINPROGRESS) {
+                        throw ConnectionException("connect to " + std::string(endpoint), errno);
+                }
+                co_await state->writable();
+
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0) {
+                        throw ConnectionException("connect to " + std::string(endpoint), err);
+                }
+        }
+        co_return async_socket(std::move(state));
+}
+
+
+#pragma region async_listener
+
+class async_listener {
+public:
+        // port为0时由内核选择，用port()查询
+        static async_listener new_with_endpoint(scheduler& s, const ipv4& endpoint, int backlog = SOMAXCONN);
+
+        async_listener(async_listener&&) = default;
+        async_listener& operator=(async_listener&&) = default;
+
+        port_t port() const noexcept {
+                return __port;
+        }
+
+        task<async_socket> accept();
+private:
+        std::unique_ptr<__async_fd> __state;
+        port_t __port {0};
+
+        async_listener(std::unique_ptr<__async_fd> state, port_t port) noexcept : __state(std::move(state)), __port(port) {}
+};
+
+inline async_listener async_listener::new_with_endpoint(scheduler& s, const ipv4& endpoint, int backlog) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+                throw ConnectionException("socket", errno);
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in sa = to_sockaddr(endpoint);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) < 0 || listen(fd, backlog) < 0) {
+                int err = errno;
+                close(fd);
+                throw ConnectionException("listen", err);
+        }
+
+        socklen_t len = sizeof(sa);
+        getsockname(fd, reinterpret_cast<sockaddr*>(&sa), &len);
+        return async_listener(__async_fd::new_with_fd(s, fd), ntohs(sa.sin_port));
+}
+
+inline task<async_socket> async_listener::accept() {
+        __async_fd* s = __state.get();
+        for (;;) {
+                int fd = accept4(s->fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd >= 0) {
+                        int one = 1;
+                        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                        co_return async_socket::new_with_fd(*s->sched, fd);
+                }
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        throw ConnectionException("accept", errno);
+                }
+                co_await s->readable();
+        }
+}
+
+#endif
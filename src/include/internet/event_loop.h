@@ -0,0 +1,204 @@
+/**
+ * epoll事件循环，定时器由timing_wheel驱动
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include "timing_wheel.h"
+
+#ifndef __Z_EVENT_LOOP
+#define __Z_EVENT_LOOP
+
+#pragma region Exceptions
+
+class EventLoopException : public std::exception {
+public:
+        EventLoopException(const std::string& op, int err)
+        : __msg(op + " failed: " + std::string(strerror(err))) {}
+
+        const char* what() const noexcept override {
+                return __msg.c_str();
+        }
+private:
+        std::string __msg;
+};
+
+
+#pragma region event_loop
+
+// 侵入式的fd监听，与timer_node一样放在使用者对象中
+struct io_watch {
+        int fd {-1};
+        void (*callback)(io_watch*, uint32_t events) {nullptr};
+        void* data {nullptr};
+};
+
+// default tick of timing wheel, 1ms
+constexpr uint64_t DEFAULT_TICK_US = 1000;
+constexpr int MAX_EVENTS_PER_POLL = 256;
+
+class event_loop {
+public:
+        static std::unique_ptr<event_loop> new_loop(uint64_t tick_us = DEFAULT_TICK_US);
+
+        event_loop(const event_loop&) = delete;
+        event_loop& operator=(const event_loop&) = delete;
+
+        ~event_loop() {
+                if (__wakefd >= 0) close(__wakefd);
+                if (__epfd >= 0) close(__epfd);
+        }
+
+        void watch(io_watch&, uint32_t events);
+        void modify(io_watch&, uint32_t events);
+        void unwatch(io_watch&) noexcept;
+
+        timing_wheel& timers() noexcept {
+                return *__wheel;
+        }
+        // 以loop创建时刻为0的单调tick
+        uint64_t now_tick() const noexcept;
+        uint64_t ticks_of_ms(uint64_t ms) const noexcept {
+                return (ms * 1000 + __tick_us - 1) / __tick_us;
+        }
+
+        // 等待一轮IO并处理到期定时器，返回处理的IO事件数量
+        size_t run_once(int max_wait_ms = -1);
+        void run();
+        // 以下两个可以从其他线程调用
+        void stop() noexcept;
+        // 打断正在阻塞的run_once
+        void wake() noexcept;
+private:
+        int __epfd {-1}, __wakefd {-1};
+        uint64_t __tick_us;
+        uint64_t __start_us;
+        std::unique_ptr<timing_wheel> __wheel;
+        std::atomic<bool> __stop {false};
+
+        explicit event_loop(uint64_t tick_us) noexcept : __tick_us(tick_us) {}
+
+        static uint64_t monotonic_us() noexcept {
+                timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        }
+};
+
+inline std::unique_ptr<event_loop> event_loop::new_loop(uint64_t tick_us) {
+        std::unique_ptr<event_loop> loop(new event_loop(tick_us == 0 ? DEFAULT_TICK_US : tick_us));
+
+        loop->__epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->__epfd < 0) {
+                throw EventLoopException("epoll_create1", errno);
+        }
+        loop->__wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->__wakefd < 0) {
+                throw EventLoopException("eventfd", errno);
+        }
+
+        // data.ptr为空表示唤醒事件
+        epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        if (epoll_ctl(loop->__epfd, EPOLL_CTL_ADD, loop->__wakefd, &ev) < 0) {
+                throw EventLoopException("epoll_ctl", errno);
+        }
+
+        loop->__start_us = monotonic_us();
+        loop->__wheel = timing_wheel::new_with_tick(0);
+        return loop;
+}
+
+inline uint64_t event_loop::now_tick() const noexcept {
+        return (monotonic_us() - __start_us) / __tick_us;
+}
+
+inline void event_loop::watch(io_watch& w, uint32_t events) {
+        epoll_event ev {};
+        ev.events = events;
+        ev.data.ptr = &w;
+        if (epoll_ctl(__epfd, EPOLL_CTL_ADD, w.fd, &ev) < 0) {
+                throw EventLoopException("epoll_ctl(ADD)", errno);
+        }
+}
+
+inline void event_loop::modify(io_watch& w, uint32_t events) {
+        epoll_event ev {};
+        ev.events = events;
+        ev.data.ptr = &w;
+        if (epoll_ctl(__epfd, EPOLL_CTL_MOD, w.fd, &ev) < 0) {
+                throw EventLoopException("epoll_ctl(MOD)", errno);
+        }
+}
+
+inline void event_loop::unwatch(io_watch& w) noexcept {
+        epoll_ctl(__epfd, EPOLL_CTL_DEL, w.fd, nullptr);
+}
+
+inline size_t event_loop::run_once(int max_wait_ms) {
+        // 等待到下一个定时器事件为止
+        int timeout = max_wait_ms;
+        uint64_t next = __wheel->next_event();
+        if (next != WHEEL_NEVER) {
+                uint64_t now = now_tick();
+                uint64_t wait_ms = next <= now ? 0 : ((next - now) * __tick_us + 999) / 1000;
+                if (timeout < 0 || wait_ms < (uint64_t)timeout) {
+                        timeout = (int)std::min(wait_ms, (uint64_t)std::numeric_limits<int>::max());
+                }
+        }
+
+        epoll_event events[MAX_EVENTS_PER_POLL];
+        int n = epoll_wait(__epfd, events, MAX_EVENTS_PER_POLL, timeout);
+        if (n < 0) {
+                if (errno != EINTR) throw EventLoopException("epoll_wait", errno);
+                n = 0;
+        }
+
+        for (int i = 0; i < n; ++i) {
+                auto w = static_cast<io_watch*>(events[i].data.ptr);
+                if (w == nullptr) {
+                        uint64_t value;
+                        while (read(__wakefd, &value, sizeof(value)) > 0) {}
+                        continue;
+                }
+                if (w->callback != nullptr) {
+                        w->callback(w, events[i].events);
+                }
+        }
+
+        __wheel->advance(now_tick());
+        return n;
+}
+
+inline void event_loop::run() {
+        while (!__stop.load(std::memory_order_acquire)) {
+                run_once();
+        }
+        __stop.store(false, std::memory_order_relaxed);
+}
+
+inline void event_loop::stop() noexcept {
+        __stop.store(true, std::memory_order_release);
+        wake();
+}
+
+inline void event_loop::wake() noexcept {
+        uint64_t one = 1;
+        ssize_t ret = write(__wakefd, &one, sizeof(one));
+        (void)ret;
+}
+
+#endif
@@ -2,8 +2,12 @@
  * 用于TCP/UDP连接库
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <iostream>
 #include <exception>
@@ -55,6 +59,8 @@ public:
         static ipv4 new_with_str(const std::string&);
         // prase from config file
         static ipv4 new_with_config() noexcept;
+        // build from host order address and port
+        static ipv4 new_with_addr(const ipv4_i&, const port_t&) noexcept;
 
         ipv4(const ipv4&) = default;
         ipv4& operator=(const ipv4&) = default;
@@ -77,6 +83,15 @@ public:
                 return this->__port;
         }
 
+        // host order address
+        ipv4_i addr() const noexcept {
+                return this->__addr;
+        }
+
+        bool operator==(const ipv4& other) const noexcept {
+                return this->__addr == other.__addr && this->__port == other.__port;
+        }
+
         static ipv4_i transfer_str_to_ipv4(const std::string&);
         static std::string transfer_ipv4_to_str(const ipv4_i&);
 private:
@@ -92,7 +107,7 @@ private:
 };
 
 // TODO prase string
-ipv4 ipv4::new_with_str(const std::string& addr) {
+inline ipv4 ipv4::new_with_str(const std::string& addr) {
         auto is_digital = [](char c) -> bool {
                 return (c >= '0' && c <= '9');
         };
@@ -103,7 +118,7 @@ ipv4 ipv4::new_with_str(const std::string& addr) {
         for (; i >= 0; --i) {
                 if (addr[i] == ':') break;
                 if (is_digital(addr[i])) {
-                        port_str += addr[i];
+                        port_str.insert(port_str.begin(), addr[i]);
                 } else {
                         throw InvalidIpv4Address(addr);
                 }
@@ -131,17 +146,21 @@ ipv4 ipv4::new_with_str(const std::string& addr) {
 }
 
 // TODO init with config
-ipv4 ipv4::new_with_config() noexcept {
+inline ipv4 ipv4::new_with_config() noexcept {
         auto ip = ipv4();
 
         return ip;
 }
 
-ipv4::~ipv4() {}
+inline ipv4 ipv4::new_with_addr(const ipv4_i& addr, const port_t& port) noexcept {
+        return ipv4(addr, port, "");
+}
+
+inline ipv4::~ipv4() {}
 
 // check invalidation first, if invalid throw an InvalidIpv4Exception
 // @param addr format is 'xxx.xxx.xxx.xxx' without port in tail
-ipv4_i ipv4::transfer_str_to_ipv4(const std::string& addr) {
+inline ipv4_i ipv4::transfer_str_to_ipv4(const std::string& addr) {
         std::vector<char> s;
         s.reserve(4);
 
@@ -184,7 +203,7 @@ ipv4_i ipv4::transfer_str_to_ipv4(const std::string& addr) {
 }
 
 // TODO
-std::string ipv4::transfer_ipv4_to_str(const ipv4_i& ip) {
+inline std::string ipv4::transfer_ipv4_to_str(const ipv4_i& ip) {
         int head = ip >> 24;
         if (head == 0) {
                 throw "can not transfer ipv4_i into string, invalid ip address " + std::to_string(ip);
@@ -201,31 +220,41 @@ std::string ipv4::transfer_ipv4_to_str(const ipv4_i& ip) {
 
 #pragma region Tools
 
-std::tuple<size_t, size_t> system_port_range() noexcept {
-        char result_buffer[1024], command[1024];
-        int rc = 0;
-        FILE *fp;
+// linux default of ip_local_port_range
+constexpr size_t DEFAULT_PORT_RANGE_LOW = 32768;
+constexpr size_t DEFAULT_PORT_RANGE_HIGH = 60999;
 
-        snprintf(command, sizeof(command), "");
+// local port range [low, high] for outbound connections, read from procfs only once
+inline std::tuple<size_t, size_t> system_port_range() noexcept {
+        static const std::tuple<size_t, size_t> range = []() -> std::tuple<size_t, size_t> {
+                const std::tuple<size_t, size_t> fallback {DEFAULT_PORT_RANGE_LOW, DEFAULT_PORT_RANGE_HIGH};
 
-        fp = popen(command, "r");
-        if (fp == nullptr) {
-                perror("execute popen failed.");
-                exit(1);
-        }
-
-
-        std::string result;
-        while (fgets(result_buffer, sizeof(result_buffer), fp) != nullptr) {
-                if ('\n' == result_buffer[strlen(result_buffer) - 1]) {
-                        result_buffer[strlen(result_buffer) - 1] = '\0';
+                int fd = open("/proc/sys/net/ipv4/ip_local_port_range", O_RDONLY | O_CLOEXEC);
+                if (fd < 0) {
+                        return fallback;
                 }
-                result += std::string(result_buffer);
-        }
 
-        std::cout << result << std::endl;
+                char buffer[64];
+                size_t len = 0;
+                while (len < sizeof(buffer) - 1) {
+                        ssize_t n = read(fd, buffer + len, sizeof(buffer) - 1 - len);
+                        if (n < 0 && errno == EINTR) continue;
+                        if (n <= 0) break;
+                        len += n;
+                }
+                close(fd);
+                buffer[len] = '\0';
+
+                // format: 'low\thigh\n'
+                unsigned long low = 0, high = 0;
+                if (sscanf(buffer, "%lu %lu", &low, &high) != 2
+                 || low == 0 || low > high || high > std::numeric_limits<port_t>::max()) {
+                        return fallback;
+                }
+                return {low, high};
+        }();
 
-        return {0, 0};
+        return range;
 }
 
 #endif
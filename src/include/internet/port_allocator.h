@@ -0,0 +1,189 @@
+/**
+ * 按目的地址分配本地端口
+ *
+ * 同一个本地端口可以同时连向不同的目的地址，只要四元组不同。
+ * 目的地址(ipv4 + port)散列到若干桶，每个桶是覆盖整个端口范围的原子位图，
+ * 分配与释放都是单次CAS，不加锁。
+ * 不同目的地址落在同一桶时只会相互少用一些端口，不会给同一目的地址重复分配。
+ *
+ * 端口以SO_REUSEADDR绑定在INADDR_ANY上，范围不能与内核的ip_local_port_range重叠，
+ * 否则会和内核为其他连接自动选择的端口冲突；最好同时加入ip_local_reserved_ports。
+ * 释放的端口在time_wait内不再分配给同一桶的目的地址，避开对端仍处于TIME_WAIT的四元组。
+ * 分配与释放由tcp_connection::new_with_allocator(dst, ports)完成。
+ */
+
+#include <errno.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include "internet.h"
+
+#ifndef __Z_PORT_ALLOCATOR
+#define __Z_PORT_ALLOCATOR
+
+#pragma region Exceptions
+
+class PortAllocatorException : public std::exception {
+public:
+        explicit PortAllocatorException(const std::string& msg) : __msg(msg) {}
+
+        const char* what() const noexcept override {
+                return __msg.c_str();
+        }
+private:
+        std::string __msg;
+};
+
+
+#pragma region port_allocator
+
+constexpr size_t DEFAULT_PORT_BUCKETS = 64;
+// linux默认的ip_local_port_range从32768开始，默认范围在它之下
+constexpr port_t DEFAULT_ALLOC_PORT_LOW = 16384;
+constexpr port_t DEFAULT_ALLOC_PORT_HIGH = 32767;
+// 2 * MSL
+constexpr uint32_t DEFAULT_PORT_TIME_WAIT_MS = 60000;
+
+class port_allocator {
+public:
+        // 端口范围[low, high]，与system_port_range()重叠时抛出异常；time_wait_ms为0时释放后立即可用
+        static std::unique_ptr<port_allocator> new_with_range(
+                port_t low = DEFAULT_ALLOC_PORT_LOW, port_t high = DEFAULT_ALLOC_PORT_HIGH,
+                size_t buckets = DEFAULT_PORT_BUCKETS, uint32_t time_wait_ms = DEFAULT_PORT_TIME_WAIT_MS
+        );
+
+        port_allocator(const port_allocator&) = delete;
+        port_allocator& operator=(const port_allocator&) = delete;
+
+        // 为连向dst的连接分配源端口，用尽时返回0
+        port_t acquire(const ipv4& dst) noexcept;
+        void release(const ipv4& dst, port_t port) noexcept;
+
+        size_t capacity() const noexcept {
+                return __range;
+        }
+private:
+        struct alignas(64) bucket_cursor {
+                std::atomic<uint32_t> next {0};
+        };
+
+        port_t __low;
+        size_t __range, __words, __buckets;
+        uint32_t __time_wait_ms;
+        // __buckets * __words个64位字
+        std::unique_ptr<std::atomic<uint64_t>[]> __bits;
+        // 每个桶中每个端口最后一次释放的毫秒时间，0表示不在隔离期；time_wait_ms为0时不分配
+        std::unique_ptr<std::atomic<uint32_t>[]> __released;
+        std::unique_ptr<bucket_cursor[]> __cursors;
+
+        port_allocator(port_t low, size_t range, size_t buckets, uint32_t time_wait_ms)
+        : __low(low), __range(range), __words((range + 63) / 64), __buckets(buckets), __time_wait_ms(time_wait_ms),
+          __bits(new std::atomic<uint64_t>[buckets * ((range + 63) / 64)]),
+          __cursors(new bucket_cursor[buckets]) {
+                for (size_t i = 0; i < __buckets * __words; ++i) {
+                        __bits[i].store(0, std::memory_order_relaxed);
+                }
+                if (__time_wait_ms > 0) {
+                        __released.reset(new std::atomic<uint32_t>[__buckets * __range]);
+                        for (size_t i = 0; i < __buckets * __range; ++i) {
+                                __released[i].store(0, std::memory_order_relaxed);
+                        }
+                }
+        }
+
+        size_t bucket_of(const ipv4& dst) const noexcept {
+                uint64_t key = (static_cast<uint64_t>(dst.addr()) << 16) | dst.port();
+                key *= 0x9E3779B97F4A7C15ULL;
+                return (key >> 32) % __buckets;
+        }
+        // 最后一个字只有range % 64位有效
+        uint64_t valid_mask(size_t word) const noexcept {
+                size_t rest = __range - word * 64;
+                return rest >= 64 ? ~0ULL : ((1ULL << rest) - 1);
+        }
+
+        // 单调毫秒时钟的低32位，按差值比较；端口被重新分配时清零，只有空闲超过49天的端口会因回绕多隔离一次
+        static uint32_t now_ms() noexcept {
+                timespec ts;
+                clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+                uint32_t ms = static_cast<uint32_t>((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+                return ms == 0 ? 1 : ms;
+        }
+        // 字w中空闲且已过隔离期的端口
+        uint64_t available(size_t bucket, size_t w, uint64_t free) const noexcept;
+};
+
+inline std::unique_ptr<port_allocator> port_allocator::new_with_range(port_t low, port_t high, size_t buckets, uint32_t time_wait_ms) {
+        const std::string range = std::to_string(low) + "-" + std::to_string(high);
+        if (low == 0 || low > high) {
+                throw PortAllocatorException("invalid port range " + range);
+        }
+        auto [sys_low, sys_high] = system_port_range();
+        if (low <= sys_high && high >= sys_low) {
+                throw PortAllocatorException("port range " + range + " overlaps ip_local_port_range "
+                                             + std::to_string(sys_low) + "-" + std::to_string(sys_high));
+        }
+        return std::unique_ptr<port_allocator>(new port_allocator(low, (size_t)high - low + 1, std::max(buckets, (size_t)1), time_wait_ms));
+}
+
+inline uint64_t port_allocator::available(size_t bucket, size_t w, uint64_t free) const noexcept {
+        if (__time_wait_ms == 0) return free;
+
+        const std::atomic<uint32_t>* released = __released.get() + bucket * __range + w * 64;
+        uint32_t now = 0;
+        uint64_t ret = free;
+        for (uint64_t rest = free; rest != 0; rest &= rest - 1) {
+                int bit = __builtin_ctzll(rest);
+                uint32_t at = released[bit].load(std::memory_order_relaxed);
+                if (at == 0) continue;
+                if (now == 0) now = now_ms();
+                if (now - at < __time_wait_ms) ret &= ~(1ULL << bit);
+        }
+        return ret;
+}
+
+inline port_t port_allocator::acquire(const ipv4& dst) noexcept {
+        size_t b = bucket_of(dst);
+        std::atomic<uint64_t>* words = __bits.get() + b * __words;
+
+        // 每次从不同的字开始，减少同一桶内的CAS竞争，也让端口轮换使用
+        size_t start = __cursors[b].next.fetch_add(1, std::memory_order_relaxed) % __words;
+        for (size_t k = 0; k < __words; ++k) {
+                size_t w = (start + k) % __words;
+                uint64_t valid = valid_mask(w);
+                uint64_t cur = words[w].load(std::memory_order_acquire);
+
+                uint64_t ready;
+                while ((ready = available(b, w, ~cur & valid)) != 0) {
+                        int bit = __builtin_ctzll(ready);
+                        if (words[w].compare_exchange_weak(cur, cur | (1ULL << bit), std::memory_order_acquire)) {
+                                if (__time_wait_ms > 0) {
+                                        __released[b * __range + w * 64 + bit].store(0, std::memory_order_relaxed);
+                                }
+                                return static_cast<port_t>(__low + w * 64 + bit);
+                        }
+                }
+        }
+        return 0;
+}
+
+inline void port_allocator::release(const ipv4& dst, port_t port) noexcept {
+        if (port < __low || (size_t)(port - __low) >= __range) return;
+
+        size_t index = port - __low;
+        size_t b = bucket_of(dst);
+        // 先记下释放时间再清位，acquire看到空闲位时一定能看到这次的时间
+        if (__time_wait_ms > 0) {
+                __released[b * __range + index].store(now_ms(), std::memory_order_relaxed);
+        }
+        std::atomic<uint64_t>* words = __bits.get() + b * __words;
+        words[index / 64].fetch_and(~(1ULL << (index % 64)), std::memory_order_release);
+}
+
+#endif
@@ -0,0 +1,308 @@
+/**
+ * ipv4最长前缀匹配表(DIR-24-8)，用于CIDR白名单与路由覆盖
+ *
+ * tbl24按地址高24位直接索引，前缀长于24位时指向一个256项的tbl8组，
+ * 查找最多两次内存访问。读者不加锁，写者之间用mutex串行，
+ * 每一项都是单个32位原子写，tbl8组先填好再挂到tbl24上。
+ */
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "internet.h"
+
+#ifndef __Z_PREFIX_TABLE
+#define __Z_PREFIX_TABLE
+
+#pragma region Exceptions
+
+class PrefixTableException : public std::exception {
+public:
+        explicit PrefixTableException(const std::string& msg) : __msg(msg) {}
+
+        const char* what() const noexcept override {
+                return __msg.c_str();
+        }
+private:
+        std::string __msg;
+};
+
+
+#pragma region prefix_table
+
+constexpr uint32_t PREFIX_NOT_FOUND = UINT32_MAX;
+// value最多24位
+constexpr uint32_t PREFIX_MAX_VALUE = (1u << 24) - 1;
+constexpr size_t DEFAULT_TBL8_GROUPS = 1024;
+
+class prefix_table {
+public:
+        static std::unique_ptr<prefix_table> new_with_groups(size_t tbl8_groups = DEFAULT_TBL8_GROUPS);
+
+        prefix_table(const prefix_table&) = delete;
+        prefix_table& operator=(const prefix_table&) = delete;
+
+        ~prefix_table();
+
+        // 插入或更新prefix/depth，prefix中depth之后的位被忽略
+        void insert(ipv4_i prefix, uint8_t depth, uint32_t value);
+        // 'xxx.xxx.xxx.xxx/len'
+        void insert(const std::string& cidr, uint32_t value);
+        bool remove(ipv4_i prefix, uint8_t depth);
+
+        // 最长匹配的value，不存在时返回PREFIX_NOT_FOUND
+        uint32_t lookup(ipv4_i ip) const noexcept;
+        void lookup_bulk(const ipv4_i* ips, uint32_t* values, size_t n) const noexcept;
+
+        size_t size() const noexcept {
+                return __rule_count;
+        }
+
+        static std::tuple<ipv4_i, uint8_t> parse_cidr(const std::string&);
+private:
+        /**
+         * entry: | valid(1) | ext(1) | depth(6) | value or tbl8 group(24) |
+         */
+        static constexpr uint32_t VALID = 1u << 31;
+        static constexpr uint32_t EXT = 1u << 30;
+        static constexpr uint32_t VALUE_MASK = (1u << 24) - 1;
+        static constexpr size_t TBL24_SIZE = 1 << 24;
+        static constexpr size_t TBL8_GROUP_SIZE = 256;
+
+        uint32_t* __tbl24 {nullptr};
+        uint32_t* __tbl8 {nullptr};
+        size_t __tbl8_groups;
+        uint32_t __tbl8_used {0};
+
+        std::mutex __mutex;
+        // 每个长度上的规则，写者计算删除后的替代项时使用
+        std::unordered_map<ipv4_i, uint32_t> __rules[33];
+        size_t __rule_count {0};
+
+        explicit prefix_table(size_t groups) noexcept : __tbl8_groups(groups) {}
+
+        static uint32_t make_entry(uint32_t value, uint8_t depth) noexcept {
+                return VALID | (static_cast<uint32_t>(depth) << 24) | value;
+        }
+        static uint8_t entry_depth(uint32_t e) noexcept {
+                return (e >> 24) & 0x3F;
+        }
+        static ipv4_i mask_of(uint8_t depth) noexcept {
+                return depth == 0 ? 0 : ~0u << (32 - depth);
+        }
+
+        static uint32_t load(const uint32_t& e, std::memory_order order = std::memory_order_relaxed) noexcept {
+                return std::atomic_ref<uint32_t>(const_cast<uint32_t&>(e)).load(order);
+        }
+        static void store(uint32_t& e, uint32_t value, std::memory_order order = std::memory_order_relaxed) noexcept {
+                std::atomic_ref<uint32_t>(e).store(value, order);
+        }
+
+        // 覆盖[first, first + count)中深度不超过depth的项
+        void fill(uint32_t* tbl, size_t first, size_t count, uint32_t entry, uint8_t depth) noexcept;
+        // 把[first, first + count)中深度等于depth的项换成replace
+        void replace(uint32_t* tbl, size_t first, size_t count, uint8_t depth, uint32_t replace_entry) noexcept;
+        uint32_t alloc_group(uint32_t init);
+};
+
+inline std::unique_ptr<prefix_table> prefix_table::new_with_groups(size_t tbl8_groups) {
+        if (tbl8_groups > VALUE_MASK + 1) {
+                throw PrefixTableException("too many tbl8 groups: " + std::to_string(tbl8_groups));
+        }
+        std::unique_ptr<prefix_table> ret(new prefix_table(tbl8_groups));
+
+        // 未触碰的页由内核按需清零，空表几乎不占物理内存
+        void* mem = mmap(NULL, TBL24_SIZE * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED) {
+                throw std::bad_alloc();
+        }
+        ret->__tbl24 = static_cast<uint32_t*>(mem);
+
+        if (tbl8_groups > 0) {
+                mem = mmap(NULL, tbl8_groups * TBL8_GROUP_SIZE * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+                if (mem == MAP_FAILED) {
+                        throw std::bad_alloc();
+                }
+                ret->__tbl8 = static_cast<uint32_t*>(mem);
+        }
+        return ret;
+}
+
+inline prefix_table::~prefix_table() {
+        if (__tbl24 != nullptr) munmap(__tbl24, TBL24_SIZE * sizeof(uint32_t));
+        if (__tbl8 != nullptr) munmap(__tbl8, __tbl8_groups * TBL8_GROUP_SIZE * sizeof(uint32_t));
+}
+
+inline void prefix_table::fill(uint32_t* tbl, size_t first, size_t count, uint32_t entry, uint8_t depth) noexcept {
+        for (size_t i = first; i < first + count; ++i) {
+                uint32_t e = load(tbl[i]);
+                if (e & EXT) {
+                        uint32_t* group = __tbl8 + (e & VALUE_MASK) * TBL8_GROUP_SIZE;
+                        fill(group, 0, TBL8_GROUP_SIZE, entry, depth);
+                } else if (!(e & VALID) || entry_depth(e) <= depth) {
+                        store(tbl[i], entry);
+                }
+        }
+}
+
+inline void prefix_table::replace(uint32_t* tbl, size_t first, size_t count, uint8_t depth, uint32_t replace_entry) noexcept {
+        for (size_t i = first; i < first + count; ++i) {
+                uint32_t e = load(tbl[i]);
+                if (e & EXT) {
+                        uint32_t* group = __tbl8 + (e & VALUE_MASK) * TBL8_GROUP_SIZE;
+                        replace(group, 0, TBL8_GROUP_SIZE, depth, replace_entry);
+                } else if ((e & VALID) && entry_depth(e) == depth) {
+                        store(tbl[i], replace_entry);
+                }
+        }
+}
+
+// tbl8组挂上后不再回收: 读者可能仍持有旧的tbl24项
+inline uint32_t prefix_table::alloc_group(uint32_t init) {
+        if (__tbl8_used >= __tbl8_groups) {
+                throw PrefixTableException("tbl8 groups exhausted (" + std::to_string(__tbl8_groups) + ")");
+        }
+        uint32_t g = __tbl8_used++;
+        uint32_t* group = __tbl8 + g * TBL8_GROUP_SIZE;
+        for (size_t i = 0; i < TBL8_GROUP_SIZE; ++i) {
+                store(group[i], init);
+        }
+        return g;
+}
+
+inline void prefix_table::insert(ipv4_i prefix, uint8_t depth, uint32_t value) {
+        if (depth > 32) {
+                throw PrefixTableException("invalid prefix length " + std::to_string(depth));
+        }
+        if (value > PREFIX_MAX_VALUE) {
+                throw PrefixTableException("value " + std::to_string(value) + " exceeds 24 bits");
+        }
+        prefix &= mask_of(depth);
+
+        std::lock_guard<std::mutex> guard(__mutex);
+        uint32_t entry = make_entry(value, depth);
+
+        if (depth <= 24) {
+                fill(__tbl24, prefix >> 8, (size_t)1 << (24 - depth), entry, depth);
+        } else {
+                uint32_t& slot = __tbl24[prefix >> 8];
+                uint32_t e = load(slot);
+                if (!(e & EXT)) {
+                        // 新组先复制原有的/24结果，填好以后再发布
+                        uint32_t g = alloc_group(e);
+                        fill(__tbl8 + g * TBL8_GROUP_SIZE, prefix & 0xFF, (size_t)1 << (32 - depth), entry, depth);
+                        store(slot, VALID | EXT | g, std::memory_order_release);
+                } else {
+                        uint32_t* group = __tbl8 + (e & VALUE_MASK) * TBL8_GROUP_SIZE;
+                        fill(group, prefix & 0xFF, (size_t)1 << (32 - depth), entry, depth);
+                }
+        }
+
+        if (__rules[depth].insert_or_assign(prefix, value).second) {
+                __rule_count++;
+        }
+}
+
+inline void prefix_table::insert(const std::string& cidr, uint32_t value) {
+        auto [prefix, depth] = parse_cidr(cidr);
+        insert(prefix, depth, value);
+}
+
+inline bool prefix_table::remove(ipv4_i prefix, uint8_t depth) {
+        if (depth > 32) return false;
+        prefix &= mask_of(depth);
+
+        std::lock_guard<std::mutex> guard(__mutex);
+        if (__rules[depth].erase(prefix) == 0) return false;
+        __rule_count--;
+
+        // 被删除范围回落到更短的覆盖规则
+        uint32_t replace_entry = 0;
+        for (int d = depth - 1; d >= 0; --d) {
+                auto iter = __rules[d].find(prefix & mask_of(d));
+                if (iter != __rules[d].end()) {
+                        replace_entry = make_entry(iter->second, d);
+                        break;
+                }
+        }
+
+        if (depth <= 24) {
+                replace(__tbl24, prefix >> 8, (size_t)1 << (24 - depth), depth, replace_entry);
+        } else {
+                uint32_t e = load(__tbl24[prefix >> 8]);
+                if (e & EXT) {
+                        uint32_t* group = __tbl8 + (e & VALUE_MASK) * TBL8_GROUP_SIZE;
+                        replace(group, prefix & 0xFF, (size_t)1 << (32 - depth), depth, replace_entry);
+                }
+        }
+        return true;
+}
+
+inline uint32_t prefix_table::lookup(ipv4_i ip) const noexcept {
+        uint32_t e = load(__tbl24[ip >> 8], std::memory_order_acquire);
+        if (e & EXT) {
+                e = load(__tbl8[(e & VALUE_MASK) * TBL8_GROUP_SIZE + (ip & 0xFF)]);
+        }
+        return (e & VALID) ? (e & VALUE_MASK) : PREFIX_NOT_FOUND;
+}
+
+inline void prefix_table::lookup_bulk(const ipv4_i* ips, uint32_t* values, size_t n) const noexcept {
+        constexpr size_t BATCH = 16;
+        uint32_t entries[BATCH];
+
+        for (size_t base = 0; base < n; base += BATCH) {
+                size_t cnt = std::min(BATCH, n - base);
+                // 先发出一批tbl24的预取，再逐个解析，隐藏缓存缺失
+                for (size_t i = 0; i < cnt; ++i) {
+                        __builtin_prefetch(&__tbl24[ips[base + i] >> 8]);
+                }
+                for (size_t i = 0; i < cnt; ++i) {
+                        entries[i] = load(__tbl24[ips[base + i] >> 8], std::memory_order_acquire);
+                        if (entries[i] & EXT) {
+                                __builtin_prefetch(&__tbl8[(entries[i] & VALUE_MASK) * TBL8_GROUP_SIZE + (ips[base + i] & 0xFF)]);
+                        }
+                }
+                for (size_t i = 0; i < cnt; ++i) {
+                        uint32_t e = entries[i];
+                        if (e & EXT) {
+                                e = load(__tbl8[(e & VALUE_MASK) * TBL8_GROUP_SIZE + (ips[base + i] & 0xFF)]);
+                        }
+                        values[base + i] = (e & VALID) ? (e & VALUE_MASK) : PREFIX_NOT_FOUND;
+                }
+        }
+}
+
+inline std::tuple<ipv4_i, uint8_t> prefix_table::parse_cidr(const std::string& cidr) {
+        auto slash = cidr.find('/');
+        if (slash == std::string::npos || slash + 1 >= cidr.size() || cidr.size() - slash > 3) {
+                throw InvalidIpv4Address(cidr);
+        }
+
+        int depth = 0;
+        for (size_t i = slash + 1; i < cidr.size(); ++i) {
+                if (cidr[i] < '0' || cidr[i] > '9') throw InvalidIpv4Address(cidr);
+                depth = depth * 10 + (cidr[i] - '0');
+        }
+        if (depth > 32) {
+                throw InvalidIpv4Address(cidr);
+        }
+
+        std::string addr = cidr.substr(0, slash);
+        // transfer_str_to_ipv4不接受全0地址，默认路由单独处理
+        ipv4_i prefix = addr == "0.0.0.0" ? 0 : ipv4::transfer_str_to_ipv4(addr);
+        return { prefix, static_cast<uint8_t>(depth) };
+}
+
+#endif
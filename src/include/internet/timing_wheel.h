@@ -0,0 +1,308 @@
+/**
+ * 分层时间轮，用于连接空闲超时、请求deadline与重试退避
+ *
+ * 每层64个槽，共11层覆盖全部64位tick；插入与取消O(1)，
+ * 同一tick到期的定时器整槽取下后批量回调。
+ * timer_node侵入式地放在使用者对象中(例如sleep_awaiter)，时间轮本身不分配内存。
+ */
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
+
+#ifndef __Z_TIMING_WHEEL
+#define __Z_TIMING_WHEEL
+
+constexpr size_t WHEEL_BITS = 6;
+constexpr size_t WHEEL_SLOTS = 1 << WHEEL_BITS;
+constexpr size_t WHEEL_LEVELS = (64 + WHEEL_BITS - 1) / WHEEL_BITS;
+constexpr uint64_t WHEEL_NEVER = std::numeric_limits<uint64_t>::max();
+
+class timing_wheel;
+
+// 双向循环链表，槽中的哨兵指向自己表示空
+struct timer_link {
+        timer_link* prev {this};
+        timer_link* next {this};
+
+        bool empty() const noexcept {
+                return next == this;
+        }
+};
+
+#pragma region timer_node
+
+struct timer_node : timer_link {
+        // 到期时调用，回调中可以重新schedule本节点；
+        // 回调抛出异常时异常传出advance()，同一tick剩余的定时器在下一次advance()时执行
+        void (*callback)(timer_node*) {nullptr};
+        void* data {nullptr};
+
+        timer_node() noexcept {
+                prev = next = nullptr;
+        }
+        timer_node(const timer_node&) = delete;
+        timer_node& operator=(const timer_node&) = delete;
+
+        ~timer_node();
+
+        bool armed() const noexcept {
+                return __owner != nullptr;
+        }
+        // 到期的绝对tick，未启动时无意义
+        uint64_t expires() const noexcept {
+                return __expires;
+        }
+        void cancel() noexcept;
+private:
+        uint64_t __expires {0};
+        timer_link* __head {nullptr};
+        timing_wheel* __owner {nullptr};
+
+        friend timing_wheel;
+};
+
+
+#pragma region timing_wheel
+
+class timing_wheel {
+public:
+        // 哨兵地址必须稳定，所以只能在堆上创建
+        static std::unique_ptr<timing_wheel> new_with_tick(uint64_t now = 0);
+
+        timing_wheel(const timing_wheel&) = delete;
+        timing_wheel& operator=(const timing_wheel&) = delete;
+
+        ~timing_wheel();
+
+        // delay个tick之后到期，至少为1；已经启动的节点会被重新放置
+        void schedule(timer_node&, uint64_t delay) noexcept;
+        void cancel(timer_node&) noexcept;
+        // 推进到now，返回本次到期回调的数量；now不大于当前tick时只执行上次因异常中断而剩下的定时器
+        size_t advance(uint64_t now);
+
+        uint64_t now() const noexcept {
+                return __now;
+        }
+        size_t size() const noexcept {
+                return __size;
+        }
+        // 下一次需要推进的绝对tick(到期或降级)，空时返回WHEEL_NEVER
+        uint64_t next_event() const noexcept;
+private:
+        timer_link __slots[WHEEL_LEVELS][WHEEL_SLOTS];
+        uint64_t __bitmap[WHEEL_LEVELS] {};
+        uint64_t __now;
+        size_t __size {0};
+
+        explicit timing_wheel(uint64_t now) noexcept : __now(now) {}
+
+        // 按到期时间与当前时间最高的不同位决定层级
+        void place(timer_node&) noexcept;
+        void unlink(timer_node&) noexcept;
+        void cascade(size_t level, size_t slot) noexcept;
+        size_t expire(size_t slot);
+};
+
+inline std::unique_ptr<timing_wheel> timing_wheel::new_with_tick(uint64_t now) {
+        return std::unique_ptr<timing_wheel>(new timing_wheel(now));
+}
+
+inline timing_wheel::~timing_wheel() {
+        for (size_t l = 0; l < WHEEL_LEVELS; ++l) {
+                for (size_t s = 0; s < WHEEL_SLOTS; ++s) {
+                        while (!__slots[l][s].empty()) {
+                                unlink(*static_cast<timer_node*>(__slots[l][s].next));
+                        }
+                }
+        }
+}
+
+inline void timing_wheel::place(timer_node& node) noexcept {
+        uint64_t diff = node.__expires ^ __now;
+        size_t level = diff == 0 ? 0 : (63 - __builtin_clzll(diff)) / WHEEL_BITS;
+        size_t slot = (node.__expires >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+
+        timer_link& head = __slots[level][slot];
+        node.prev = head.prev;
+        node.next = &head;
+        head.prev->next = &node;
+        head.prev = &node;
+
+        node.__head = &head;
+        __bitmap[level] |= (1ULL << slot);
+}
+
+inline void timing_wheel::unlink(timer_node& node) noexcept {
+        node.prev->next = node.next;
+        node.next->prev = node.prev;
+        node.prev = node.next = nullptr;
+
+        timer_link* head = node.__head;
+        if (head->empty()) {
+                // 批量到期时节点挂在临时链表上，不属于任何槽
+                const timer_link* base = &__slots[0][0];
+                if (std::greater_equal<const timer_link*>()(head, base)
+                 && std::less<const timer_link*>()(head, base + WHEEL_LEVELS * WHEEL_SLOTS)) {
+                        size_t index = head - base;
+                        __bitmap[index / WHEEL_SLOTS] &= ~(1ULL << (index % WHEEL_SLOTS));
+                }
+        }
+
+        node.__head = nullptr;
+        node.__owner = nullptr;
+        __size--;
+}
+
+inline void timing_wheel::schedule(timer_node& node, uint64_t delay) noexcept {
+        if (node.__owner != nullptr) {
+                node.__owner->unlink(node);
+        }
+
+        delay = std::max(delay, (uint64_t)1);
+        node.__expires = (__now > WHEEL_NEVER - delay) ? WHEEL_NEVER : __now + delay;
+        node.__owner = this;
+        __size++;
+        place(node);
+}
+
+inline void timing_wheel::cancel(timer_node& node) noexcept {
+        if (node.__owner == this) {
+                unlink(node);
+        }
+}
+
+inline uint64_t timing_wheel::next_event() const noexcept {
+        // 回调异常后留在当前槽的定时器
+        if (__bitmap[0] & (1ULL << (__now & (WHEEL_SLOTS - 1)))) {
+                return __now;
+        }
+
+        uint64_t ret = WHEEL_NEVER;
+        for (size_t l = 0; l < WHEEL_LEVELS; ++l) {
+                if (__bitmap[l] == 0) continue;
+
+                // 每层中已有的槽一定在当前位置之后
+                size_t shift = l * WHEEL_BITS;
+                size_t pos = (__now >> shift) & (WHEEL_SLOTS - 1);
+                uint64_t mask = pos + 1 >= WHEEL_SLOTS ? 0 : __bitmap[l] & (~0ULL << (pos + 1));
+                if (mask == 0) continue;
+
+                size_t upper = shift + WHEEL_BITS;
+                uint64_t base = upper >= 64 ? 0 : (__now >> upper) << upper;
+                uint64_t tick = base | ((uint64_t)__builtin_ctzll(mask) << shift);
+                ret = std::min(ret, tick);
+        }
+        return ret;
+}
+
+inline void timing_wheel::cascade(size_t level, size_t slot) noexcept {
+        timer_link& head = __slots[level][slot];
+        __bitmap[level] &= ~(1ULL << slot);
+
+        // 先整体摘下，再按当前时间重新放入更低的层
+        timer_link* node = head.next;
+        head.prev = head.next = &head;
+        while (node != &head) {
+                timer_link* next = node->next;
+                place(*static_cast<timer_node*>(node));
+                node = next;
+        }
+}
+
+inline size_t timing_wheel::expire(size_t slot) {
+        timer_link& head = __slots[0][slot];
+        if (head.empty()) return 0;
+
+        // 整槽移到临时链表，回调中新加入的定时器不会在本轮被执行
+        timer_link batch;
+        batch.next = head.next;
+        batch.prev = head.prev;
+        batch.next->prev = &batch;
+        batch.prev->next = &batch;
+        head.prev = head.next = &head;
+        __bitmap[0] &= ~(1ULL << slot);
+        for (timer_link* n = batch.next; n != &batch; n = n->next) {
+                static_cast<timer_node*>(n)->__head = &batch;
+        }
+
+        size_t fired = 0;
+        try {
+                while (!batch.empty()) {
+                        timer_node& node = *static_cast<timer_node*>(batch.next);
+                        unlink(node);
+                        fired++;
+                        if (node.callback != nullptr) {
+                                node.callback(&node);
+                        }
+                }
+        } catch (...) {
+                // 剩余节点不能留在栈上的batch里，放回当前槽。
+                // 回调中新设置的定时器都晚于当前tick，不会进入这个槽
+                if (!batch.empty()) {
+                        head.next = batch.next;
+                        head.prev = batch.prev;
+                        head.next->prev = &head;
+                        head.prev->next = &head;
+                        for (timer_link* n = head.next; n != &head; n = n->next) {
+                                static_cast<timer_node*>(n)->__head = &head;
+                        }
+                        __bitmap[0] |= (1ULL << slot);
+                }
+                throw;
+        }
+        return fired;
+}
+
+inline size_t timing_wheel::advance(uint64_t now) {
+        // 正常情况下当前槽为空，只有回调抛出异常后才会有剩余
+        size_t fired = expire(__now & (WHEEL_SLOTS - 1));
+        while (__now < now) {
+                // 中间没有任何到期或降级时直接跳过
+                uint64_t next = next_event();
+                if (next > now) {
+                        __now = now;
+                        break;
+                }
+                __now = next;
+
+                // 从高层往低层降级，落在当前tick的定时器最终进入第0层当前槽
+                for (size_t l = WHEEL_LEVELS - 1; l > 0; --l) {
+                        size_t shift = l * WHEEL_BITS;
+                        if ((__now & ((1ULL << shift) - 1)) != 0) continue;
+
+                        size_t slot = (__now >> shift) & (WHEEL_SLOTS - 1);
+                        if (__bitmap[l] & (1ULL << slot)) {
+                                cascade(l, slot);
+                        }
+                }
+                fired += expire(__now & (WHEEL_SLOTS - 1));
+        }
+        return fired;
+}
+
+
+#pragma region timer_node Part
+
+inline timer_node::~timer_node() {
+        cancel();
+}
+
+inline void timer_node::cancel() noexcept {
+        if (__owner != nullptr) {
+                __owner->cancel(*this);
+        }
+}
+
+// 指数退避，attempt从0开始，结果不超过cap
+inline uint64_t backoff_ticks(unsigned attempt, uint64_t base, uint64_t cap) noexcept {
+        if (attempt >= 63 || base > (cap >> std::min(attempt, 63u))) {
+                return cap;
+        }
+        return std::min(cap, base << attempt);
+}
+
+#endif
@@ -0,0 +1,507 @@
+/**
+ * 页对齐内存的零拷贝收发
+ *
+ * 发送: MSG_ZEROCOPY，内核确认完成前一直持有(pin)页的所有者
+ * 文件: splice，page cache直接送到socket
+ * 接收: readv按页分散读入新映射的内存
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "../storage/zstorage.h"
+
+#ifndef __Z_ZCOPY
+#define __Z_ZCOPY
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#pragma region Exceptions
+
+class ZeroCopyException : public std::exception {
+public:
+        ZeroCopyException(const std::string& op, int err)
+        : __msg(op + " failed: " + std::string(strerror(err))) {}
+
+        const char* what() const noexcept override {
+                return __msg.c_str();
+        }
+private:
+        std::string __msg;
+};
+
+
+#pragma region Region
+
+// 一段连续内存，发送时只读，接收时写入
+struct zcopy_region {
+        void* base;
+        size_t len;
+};
+
+// 跳过iov头部已经处理的n个字节，返回新的起点
+inline size_t __zcopy_advance(std::vector<iovec>& iov, size_t start, size_t n) noexcept {
+        while (n > 0 && start < iov.size()) {
+                if (n >= iov[start].iov_len) {
+                        n -= iov[start].iov_len;
+                        iov[start].iov_len = 0;
+                        start++;
+                } else {
+                        iov[start].iov_base = static_cast<char*>(iov[start].iov_base) + n;
+                        iov[start].iov_len -= n;
+                        n = 0;
+                }
+        }
+        return start;
+}
+
+// 超时后内核仍未释放的pin，进程退出前不会析构
+inline std::vector<std::shared_ptr<const void>>& __zcopy_leaked() noexcept {
+        static auto* leaked = new std::vector<std::shared_ptr<const void>>();
+        return *leaked;
+}
+
+inline std::mutex& __zcopy_leaked_mutex() noexcept {
+        static std::mutex mutex;
+        return mutex;
+}
+
+// 因内核迟迟不确认而泄漏的pin数量
+inline size_t zcopy_leaked_pins() noexcept {
+        std::lock_guard<std::mutex> lock(__zcopy_leaked_mutex());
+        return __zcopy_leaked().size();
+}
+
+inline void __zcopy_wait(int fd, short events, int timeout_ms) {
+        pollfd pfd { fd, events, 0 };
+        while (poll(&pfd, 1, timeout_ms) < 0) {
+                if (errno != EINTR) throw ZeroCopyException("poll", errno);
+        }
+}
+
+
+#pragma region zcopy_sender
+
+// 析构时等待未完成发送的最长时间
+constexpr int ZCOPY_CLOSE_TIMEOUT_MS = 1000;
+
+// 单个socket上的MSG_ZEROCOPY发送端，不支持SO_ZEROCOPY时退化为普通sendmsg
+class zcopy_sender {
+public:
+        static zcopy_sender new_with_fd(int fd) noexcept;
+
+        zcopy_sender(const zcopy_sender&) = delete;
+        zcopy_sender& operator=(const zcopy_sender&) = delete;
+        zcopy_sender(zcopy_sender&& other) noexcept
+        : __fd(other.__fd), __zerocopy(other.__zerocopy), __next_id(other.__next_id),
+          __copied(other.__copied), __pending(std::move(other.__pending)) {
+                other.__fd = -1;
+                other.__pending.clear();
+        }
+        zcopy_sender& operator=(zcopy_sender&& other) noexcept {
+                if (this != &other) {
+                        release();
+                        __fd = other.__fd;
+                        __zerocopy = other.__zerocopy;
+                        __next_id = other.__next_id;
+                        __copied = other.__copied;
+                        __pending = std::move(other.__pending);
+                        other.__fd = -1;
+                        other.__pending.clear();
+                }
+                return *this;
+        }
+
+        // 内核可能仍在引用页内存，有限等待完成通知，见release()
+        ~zcopy_sender() {
+                release();
+        }
+
+        // 发送regions中的全部字节，pin持有页的所有者直到内核完成通知
+        size_t send(const zcopy_region* regions, size_t n, std::shared_ptr<const void> pin = nullptr);
+        // 非阻塞读取完成通知，返回被释放的pin数量
+        size_t reap();
+        // 等待全部发送完成，超时返回false
+        bool drain(int timeout_ms = -1);
+
+        bool zerocopy() const noexcept {
+                return __zerocopy;
+        }
+        // 尚未完成的发送
+        size_t pending() const noexcept {
+                return __pending.size();
+        }
+        // 内核退化为拷贝的完成通知数量(例如loopback)，用于判断零拷贝是否生效
+        size_t copied() const noexcept {
+                return __copied;
+        }
+private:
+        struct pending_send {
+                // 一次send可能对应多次sendmsg，占用从first开始的count个通知序号(可能回绕)
+                uint32_t first, count;
+                uint32_t outstanding;
+                // send()还在进行中，outstanding为0也不能移除
+                bool sending;
+                std::shared_ptr<const void> pin;
+        };
+
+        int __fd {-1};
+        bool __zerocopy {false};
+        // 内核为每次成功的MSG_ZEROCOPY sendmsg分配一个递增序号
+        uint32_t __next_id {0};
+        size_t __copied {0};
+        std::deque<pending_send> __pending;
+
+        zcopy_sender(int fd, bool zerocopy) noexcept : __fd(fd), __zerocopy(zerocopy) {}
+
+        void complete(uint32_t lo, uint32_t hi) noexcept;
+        // 已经发出、尚未确认的sendmsg次数
+        size_t in_flight() const noexcept {
+                size_t n = 0;
+                for (auto &p : __pending) n += p.outstanding;
+                return n;
+        }
+        void release() noexcept;
+};
+
+inline zcopy_sender zcopy_sender::new_with_fd(int fd) noexcept {
+        int one = 1;
+        bool enabled = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+        return zcopy_sender(fd, enabled);
+}
+
+inline size_t zcopy_sender::send(const zcopy_region* regions, size_t n, std::shared_ptr<const void> pin) {
+        std::vector<iovec> iov;
+        iov.reserve(n);
+        size_t total = 0;
+        for (size_t i = 0; i < n; ++i) {
+                if (regions[i].len == 0) continue;
+                iov.push_back({ regions[i].base, regions[i].len });
+                total += regions[i].len;
+        }
+
+        // 先登记本次发送的序号区间，发送过程中reap()收到的通知才能对应上
+        if (__zerocopy) {
+                __pending.push_back({ __next_id, 0, 0, true, std::move(pin) });
+        }
+        // 本次send一定在队尾: 只有send()会追加，reap()不会移除sending的条目
+        auto finish = [this]() noexcept {
+                if (!__zerocopy) return;
+                __pending.back().sending = false;
+                if (__pending.back().count == 0) __pending.pop_back();
+        };
+
+        size_t start = 0, sent = 0;
+        bool copy_once = false;
+        try {
+                while (sent < total) {
+                        msghdr msg {};
+                        msg.msg_iov = iov.data() + start;
+                        msg.msg_iovlen = std::min(iov.size() - start, (size_t)IOV_MAX);
+
+                        const bool zc = __zerocopy && !copy_once;
+                        ssize_t ret = sendmsg(__fd, &msg, (zc ? MSG_ZEROCOPY : 0) | MSG_NOSIGNAL);
+                        if (ret < 0) {
+                                if (errno == EINTR) continue;
+                                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                        __zcopy_wait(__fd, POLLOUT, -1);
+                                        continue;
+                                }
+                                if (errno == ENOBUFS && zc) {
+                                        // optmem被未完成的通知占满，先回收；没有未完成的通知时不会再有通知到达，
+                                        // 这一次改为普通拷贝发送
+                                        if (reap() == 0) {
+                                                if (in_flight() == 0) copy_once = true;
+                                                else __zcopy_wait(__fd, 0, -1);
+                                        }
+                                        continue;
+                                }
+                                throw ZeroCopyException("sendmsg", errno);
+                        }
+
+                        if (zc) {
+                                __next_id++;
+                                __pending.back().count++;
+                                __pending.back().outstanding++;
+                        }
+                        copy_once = false;
+                        sent += ret;
+                        start = __zcopy_advance(iov, start, ret);
+                }
+        } catch (...) {
+                finish();
+                throw;
+        }
+
+        finish();
+        return sent;
+}
+
+// 通知序号区间[lo, hi]已经完成
+inline void zcopy_sender::complete(uint32_t lo, uint32_t hi) noexcept {
+        // 序号是32位且会回绕，按相对first的偏移求交集
+        for (auto &p : __pending) {
+                if (p.count == 0) continue;
+                int64_t from = static_cast<int32_t>(lo - p.first);
+                int64_t to = from + static_cast<uint32_t>(hi - lo);
+                from = std::max<int64_t>(from, 0);
+                to = std::min<int64_t>(to, static_cast<int64_t>(p.count) - 1);
+                if (from <= to) {
+                        p.outstanding -= static_cast<uint32_t>(to - from + 1);
+                }
+        }
+}
+
+inline size_t zcopy_sender::reap() {
+        if (!__zerocopy) return 0;
+
+        char control[128];
+        for (;;) {
+                msghdr msg {};
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+
+                if (recvmsg(__fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                        if (errno == EINTR) continue;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                        throw ZeroCopyException("recvmsg(MSG_ERRQUEUE)", errno);
+                }
+
+                for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+                        bool ip_err = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                                   || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+                        if (!ip_err) continue;
+
+                        auto serr = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cm));
+                        if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+                        if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                                __copied++;
+                        }
+                        complete(serr->ee_info, serr->ee_data);
+                }
+        }
+
+        size_t before = __pending.size();
+        std::erase_if(__pending, [](const pending_send& p) { return p.outstanding == 0 && !p.sending; });
+        return before - __pending.size();
+}
+
+// 有限等待后仍未完成的pin移交给zcopy_leaked_pins()计数的全局列表，永不释放:
+// 页所有者泄漏，但内核引用期间内存不会被复用
+inline void zcopy_sender::release() noexcept {
+        if (__fd < 0 || __pending.empty()) return;
+        bool done = false;
+        try {
+                done = drain(ZCOPY_CLOSE_TIMEOUT_MS);
+        } catch (...) {}
+        if (!done) {
+                std::lock_guard<std::mutex> lock(__zcopy_leaked_mutex());
+                auto& leaked = __zcopy_leaked();
+                for (auto &p : __pending) {
+                        if (p.pin == nullptr) continue;
+                        try {
+                                leaked.push_back(std::move(p.pin));
+                        } catch (...) {
+                                // 内存不足时只能真正丢掉引用计数
+                                new (std::nothrow) std::shared_ptr<const void>(std::move(p.pin));
+                        }
+                }
+                fprintf(stderr, "zcopy_sender: %zu sends still referenced by the kernel after %d ms, pins leaked\n",
+                        __pending.size(), ZCOPY_CLOSE_TIMEOUT_MS);
+        }
+        __pending.clear();
+}
+
+// timeout_ms为总时长，负数表示一直等待
+inline bool zcopy_sender::drain(int timeout_ms) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeout_ms, 0));
+        while (reap(), !__pending.empty()) {
+                int wait = -1;
+                if (timeout_ms >= 0) {
+                        auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+                        if (left <= 0) return false;
+                        wait = static_cast<int>(left);
+                }
+                pollfd pfd { __fd, 0, 0 };
+                if (poll(&pfd, 1, wait) < 0 && errno != EINTR) throw ZeroCopyException("poll", errno);
+        }
+        return true;
+}
+
+
+#pragma region zcopy_splicer
+
+// file -> pipe -> socket，数据停留在page cache中，不经过用户态
+class zcopy_splicer {
+public:
+        static zcopy_splicer new_splicer();
+
+        zcopy_splicer(const zcopy_splicer&) = delete;
+        zcopy_splicer& operator=(const zcopy_splicer&) = delete;
+        zcopy_splicer(zcopy_splicer&& other) noexcept : __pipe { other.__pipe[0], other.__pipe[1] } {
+                other.__pipe[0] = other.__pipe[1] = -1;
+        }
+
+        ~zcopy_splicer() {
+                if (__pipe[0] >= 0) close(__pipe[0]);
+                if (__pipe[1] >= 0) close(__pipe[1]);
+        }
+
+        // 发送file_fd中[offset, offset + len)到sock，返回发送字节数(遇到文件结尾时可能小于len)
+        size_t send_file(int sock, int file_fd, off_t offset, size_t len);
+private:
+        int __pipe[2] {-1, -1};
+
+        zcopy_splicer() noexcept {}
+};
+
+inline zcopy_splicer zcopy_splicer::new_splicer() {
+        zcopy_splicer ret;
+        if (pipe2(ret.__pipe, O_CLOEXEC) < 0) {
+                throw ZeroCopyException("pipe2", errno);
+        }
+        return ret;
+}
+
+inline size_t zcopy_splicer::send_file(int sock, int file_fd, off_t offset, size_t len) {
+        size_t sent = 0;
+        while (sent < len) {
+                ssize_t in = splice(file_fd, &offset, __pipe[1], nullptr, len - sent, SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (in < 0) {
+                        if (errno == EINTR) continue;
+                        throw ZeroCopyException("splice(file)", errno);
+                }
+                if (in == 0) break;
+
+                // pipe中的数据必须全部送出，否则下一轮会和新数据混在一起
+                while (in > 0) {
+                        ssize_t out = splice(__pipe[0], nullptr, sock, nullptr, in, SPLICE_F_MOVE | SPLICE_F_MORE);
+                        if (out < 0) {
+                                if (errno == EINTR) continue;
+                                if (errno == EAGAIN) {
+                                        __zcopy_wait(sock, POLLOUT, -1);
+                                        continue;
+                                }
+                                throw ZeroCopyException("splice(socket)", errno);
+                        }
+                        in -= out;
+                        sent += out;
+                }
+        }
+        return sent;
+}
+
+
+#pragma region Receive
+
+// 新映射的匿名页，大小按BASE_ALLOCATOR_UNIT对齐
+class page_buffer {
+public:
+        static page_buffer new_with_size(size_t bytes);
+
+        page_buffer(const page_buffer&) = delete;
+        page_buffer& operator=(const page_buffer&) = delete;
+        page_buffer(page_buffer&& other) noexcept : __mem(other.__mem), __capacity(other.__capacity) {
+                other.__mem = nullptr;
+                other.__capacity = 0;
+        }
+
+        ~page_buffer() {
+                if (__mem != nullptr) munmap(__mem, __capacity);
+        }
+
+        void* data() const noexcept {
+                return __mem;
+        }
+        size_t capacity() const noexcept {
+                return __capacity;
+        }
+        // 以页为单位切分，用于分散读
+        std::vector<zcopy_region> pages() const;
+private:
+        void* __mem {nullptr};
+        size_t __capacity {0};
+
+        page_buffer() noexcept {}
+};
+
+inline page_buffer page_buffer::new_with_size(size_t bytes) {
+        page_buffer ret;
+        ret.__capacity = (bytes + BASE_ALLOCATOR_UNIT - 1) / BASE_ALLOCATOR_UNIT * BASE_ALLOCATOR_UNIT;
+        if (ret.__capacity == 0) return ret;
+
+        void* mem = mmap(NULL, ret.__capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+                ret.__capacity = 0;
+                throw std::bad_alloc();
+        }
+        ret.__mem = mem;
+        return ret;
+}
+
+inline std::vector<zcopy_region> page_buffer::pages() const {
+        std::vector<zcopy_region> ret;
+        ret.reserve(__capacity / BASE_ALLOCATOR_UNIT);
+        for (size_t off = 0; off < __capacity; off += BASE_ALLOCATOR_UNIT) {
+                ret.push_back({ static_cast<char*>(__mem) + off, BASE_ALLOCATOR_UNIT });
+        }
+        return ret;
+}
+
+// 分散读满regions，返回读到的字节数，对端关闭时可能小于总长度
+inline size_t zcopy_recv(int fd, const zcopy_region* regions, size_t n) {
+        std::vector<iovec> iov;
+        iov.reserve(n);
+        size_t total = 0;
+        for (size_t i = 0; i < n; ++i) {
+                if (regions[i].len == 0) continue;
+                iov.push_back({ regions[i].base, regions[i].len });
+                total += regions[i].len;
+        }
+
+        size_t start = 0, got = 0;
+        while (got < total) {
+                ssize_t ret = readv(fd, iov.data() + start, std::min(iov.size() - start, (size_t)IOV_MAX));
+                if (ret < 0) {
+                        if (errno == EINTR) continue;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                __zcopy_wait(fd, POLLIN, -1);
+                                continue;
+                        }
+                        throw ZeroCopyException("readv", errno);
+                }
+                if (ret == 0) break;
+
+                got += ret;
+                start = __zcopy_advance(iov, start, ret);
+        }
+        return got;
+}
+
+#endif
@@ -0,0 +1,631 @@
+/**
+ * 环成员的二进制快照
+ *
+ * 快照是一块平坦的内存: 头部 + 节点表 + 有序token数组 + token所属节点数组，
+ * 全部按偏移访问、64字节对齐，mmap或收到以后不需要解析就能直接路由。
+ * 两个版本之间可以生成增量，只包含增删的节点与token。
+ *
+ * 字节序为本机字节序，magic不匹配即拒绝。
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "internet/internet.h"
+
+#ifndef __Z_RING_SNAPSHOT
+#define __Z_RING_SNAPSHOT
+
+#pragma region Exceptions
+
+class RingSnapshotException : public std::exception {
+public:
+        explicit RingSnapshotException(const std::string& msg) : __msg(msg) {}
+
+        const char* what() const noexcept override {
+                return __msg.c_str();
+        }
+private:
+        std::string __msg;
+};
+
+
+#pragma region Format
+
+constexpr uint32_t RING_SNAPSHOT_MAGIC = 0x474E525A;    // 'ZRNG'
+constexpr uint32_t RING_DELTA_MAGIC = 0x4C44525A;       // 'ZRDL'
+constexpr uint16_t RING_SNAPSHOT_FORMAT = 1;
+constexpr size_t RING_SNAPSHOT_ALIGN = 64;
+
+struct ring_snapshot_header {
+        uint32_t magic;
+        uint16_t format;
+        uint16_t header_size;
+        uint64_t version;
+        uint32_t node_count;
+        uint32_t token_count;
+        // 相对快照起始位置的偏移
+        uint64_t nodes_offset;          // ring_snapshot_node[node_count]
+        uint64_t tokens_offset;         // uint32_t[token_count]，升序
+        uint64_t owners_offset;         // uint32_t[token_count]，节点下标
+        uint64_t total_size;
+        // 头部之后全部字节的FNV-1a
+        uint32_t checksum;
+        uint32_t reserved;
+};
+static_assert(sizeof(ring_snapshot_header) == 64);
+
+// 节点表按(addr, port)升序，版本之间的节点下标因此是确定的
+struct ring_snapshot_node {
+        ipv4_i addr;
+        port_t port;
+        uint16_t reserved;
+};
+static_assert(sizeof(ring_snapshot_node) == 8);
+
+// seed为上一段的结果时可以分段计算
+inline uint32_t ring_snapshot_checksum(const void* data, size_t size, uint32_t seed = 2166136261u) noexcept {
+        uint32_t h = seed;
+        auto p = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+                h = (h ^ p[i]) * 16777619u;
+        }
+        return h;
+}
+
+inline size_t __snapshot_align(size_t n) noexcept {
+        return (n + RING_SNAPSHOT_ALIGN - 1) / RING_SNAPSHOT_ALIGN * RING_SNAPSHOT_ALIGN;
+}
+
+
+#pragma region ring_snapshot_view
+
+// 只读视图，不拥有内存
+class ring_snapshot_view {
+public:
+        // verify为true时检查校验和、token有序与节点下标范围
+        static ring_snapshot_view new_with_buffer(const void* data, size_t size, bool verify = true);
+
+        uint64_t version() const noexcept {
+                return __header->version;
+        }
+        uint32_t checksum() const noexcept {
+                return __header->checksum;
+        }
+        size_t node_count() const noexcept {
+                return __header->node_count;
+        }
+        size_t token_count() const noexcept {
+                return __header->token_count;
+        }
+        const ring_snapshot_node& node(size_t index) const noexcept {
+                return __nodes[index];
+        }
+        uint32_t token(size_t index) const noexcept {
+                return __tokens[index];
+        }
+        uint32_t owner(size_t index) const noexcept {
+                return __owners[index];
+        }
+        ipv4 endpoint(size_t index) const noexcept {
+                return ipv4::new_with_addr(__nodes[index].addr, __nodes[index].port);
+        }
+
+        const void* data() const noexcept {
+                return __header;
+        }
+        size_t size() const noexcept {
+                return __header->total_size;
+        }
+
+        // 顺时针第一个不小于hash的token所属节点下标
+        uint32_t route(uint32_t hash) const;
+        const ring_snapshot_node& route_node(uint32_t hash) const {
+                return __nodes[route(hash)];
+        }
+private:
+        const ring_snapshot_header* __header {nullptr};
+        const ring_snapshot_node* __nodes {nullptr};
+        const uint32_t* __tokens {nullptr};
+        const uint32_t* __owners {nullptr};
+
+        ring_snapshot_view() noexcept {}
+};
+
+inline ring_snapshot_view ring_snapshot_view::new_with_buffer(const void* data, size_t size, bool verify) {
+        if (data == nullptr || size < sizeof(ring_snapshot_header) || reinterpret_cast<uintptr_t>(data) % alignof(ring_snapshot_header) != 0) {
+                throw RingSnapshotException("snapshot buffer too small or misaligned");
+        }
+
+        auto h = static_cast<const ring_snapshot_header*>(data);
+        if (h->magic != RING_SNAPSHOT_MAGIC) {
+                throw RingSnapshotException("bad snapshot magic");
+        }
+        if (h->format != RING_SNAPSHOT_FORMAT || h->header_size != sizeof(ring_snapshot_header)) {
+                throw RingSnapshotException("unsupported snapshot format " + std::to_string(h->format));
+        }
+        if (h->total_size > size) {
+                throw RingSnapshotException("truncated snapshot: " + std::to_string(size) + " of " + std::to_string(h->total_size) + " bytes");
+        }
+
+        auto in_range = [h](uint64_t offset, uint64_t bytes) {
+                return offset % RING_SNAPSHOT_ALIGN == 0 && offset >= sizeof(ring_snapshot_header)
+                    && offset <= h->total_size && bytes <= h->total_size - offset;
+        };
+        if (!in_range(h->nodes_offset, (uint64_t)h->node_count * sizeof(ring_snapshot_node))
+         || !in_range(h->tokens_offset, (uint64_t)h->token_count * sizeof(uint32_t))
+         || !in_range(h->owners_offset, (uint64_t)h->token_count * sizeof(uint32_t))) {
+                throw RingSnapshotException("snapshot section out of range");
+        }
+        if (h->token_count > 0 && h->node_count == 0) {
+                throw RingSnapshotException("snapshot has tokens but no nodes");
+        }
+
+        auto base = static_cast<const char*>(data);
+        ring_snapshot_view ret;
+        ret.__header = h;
+        ret.__nodes = reinterpret_cast<const ring_snapshot_node*>(base + h->nodes_offset);
+        ret.__tokens = reinterpret_cast<const uint32_t*>(base + h->tokens_offset);
+        ret.__owners = reinterpret_cast<const uint32_t*>(base + h->owners_offset);
+
+        if (verify) {
+                if (ring_snapshot_checksum(base + sizeof(ring_snapshot_header), h->total_size - sizeof(ring_snapshot_header)) != h->checksum) {
+                        throw RingSnapshotException("snapshot checksum mismatch");
+                }
+                for (size_t i = 0; i < h->token_count; ++i) {
+                        if ((i > 0 && ret.__tokens[i - 1] >= ret.__tokens[i]) || ret.__owners[i] >= h->node_count) {
+                                throw RingSnapshotException("snapshot token table is corrupted at " + std::to_string(i));
+                        }
+                }
+        }
+        return ret;
+}
+
+inline uint32_t ring_snapshot_view::route(uint32_t hash) const {
+        size_t n = __header->token_count;
+        if (n == 0) {
+                throw std::out_of_range("can not route on empty ring snapshot");
+        }
+
+        // 无分支二分查找，只访问有序token数组
+        const uint32_t* base = __tokens;
+        while (n > 1) {
+                size_t half = n / 2;
+                base = (base[half - 1] < hash) ? base + half : base;
+                n -= half;
+        }
+        size_t index = (base - __tokens) + (*base < hash);
+        if (index == __header->token_count) index = 0;
+        return __owners[index];
+}
+
+
+#pragma region ring_snapshot_builder
+
+class ring_snapshot_builder {
+public:
+        static ring_snapshot_builder new_with_version(uint64_t version) noexcept {
+                return ring_snapshot_builder(version);
+        }
+
+        // 同一endpoint多次添加时合并token
+        void add_node(const ipv4& endpoint, const std::vector<uint32_t>& tokens);
+        std::vector<char> build() const;
+private:
+        uint64_t __version;
+        std::vector<std::tuple<ipv4_i, port_t>> __nodes;
+        // endpoint -> 在__nodes中的下标
+        std::unordered_map<uint64_t, uint32_t> __index;
+        // (token, 在__nodes中的下标)
+        std::vector<std::tuple<uint32_t, uint32_t>> __tokens;
+
+        explicit ring_snapshot_builder(uint64_t version) noexcept : __version(version) {}
+
+        friend std::vector<char> ring_snapshot_apply_delta(const ring_snapshot_view&, const void*, size_t);
+};
+
+inline void ring_snapshot_builder::add_node(const ipv4& endpoint, const std::vector<uint32_t>& tokens) {
+        uint64_t key = (static_cast<uint64_t>(endpoint.addr()) << 16) | endpoint.port();
+        auto [iter, inserted] = __index.try_emplace(key, static_cast<uint32_t>(__nodes.size()));
+        uint32_t index = iter->second;
+        if (inserted) {
+                __nodes.emplace_back(endpoint.addr(), endpoint.port());
+        }
+        for (auto token : tokens) {
+                __tokens.emplace_back(token, index);
+        }
+}
+
+inline std::vector<char> ring_snapshot_builder::build() const {
+        // 节点按(addr, port)排序，old -> new下标
+        std::vector<uint32_t> order(__nodes.size());
+        for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+        std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return __nodes[a] < __nodes[b]; });
+        std::vector<uint32_t> remap(__nodes.size());
+        for (uint32_t i = 0; i < order.size(); ++i) remap[order[i]] = i;
+
+        // token冲突时归排序后下标最小的节点，结果与添加顺序无关
+        std::vector<std::tuple<uint32_t, uint32_t>> tokens;
+        tokens.reserve(__tokens.size());
+        for (auto &[token, index] : __tokens) {
+                tokens.emplace_back(token, remap[index]);
+        }
+        std::sort(tokens.begin(), tokens.end());
+        tokens.erase(std::unique(tokens.begin(), tokens.end(), [](const auto& a, const auto& b) {
+                return std::get<0>(a) == std::get<0>(b);
+        }), tokens.end());
+
+        ring_snapshot_header h {};
+        h.magic = RING_SNAPSHOT_MAGIC;
+        h.format = RING_SNAPSHOT_FORMAT;
+        h.header_size = sizeof(ring_snapshot_header);
+        h.version = __version;
+        h.node_count = __nodes.size();
+        h.token_count = tokens.size();
+        h.nodes_offset = sizeof(ring_snapshot_header);
+        h.tokens_offset = __snapshot_align(h.nodes_offset + h.node_count * sizeof(ring_snapshot_node));
+        h.owners_offset = __snapshot_align(h.tokens_offset + h.token_count * sizeof(uint32_t));
+        h.total_size = __snapshot_align(h.owners_offset + h.token_count * sizeof(uint32_t));
+
+        std::vector<char> buffer(h.total_size, 0);
+        auto nodes = reinterpret_cast<ring_snapshot_node*>(buffer.data() + h.nodes_offset);
+        for (uint32_t i = 0; i < order.size(); ++i) {
+                nodes[i].addr = std::get<0>(__nodes[order[i]]);
+                nodes[i].port = std::get<1>(__nodes[order[i]]);
+        }
+        auto token_arr = reinterpret_cast<uint32_t*>(buffer.data() + h.tokens_offset);
+        auto owner_arr = reinterpret_cast<uint32_t*>(buffer.data() + h.owners_offset);
+        for (size_t i = 0; i < tokens.size(); ++i) {
+                token_arr[i] = std::get<0>(tokens[i]);
+                owner_arr[i] = std::get<1>(tokens[i]);
+        }
+
+        h.checksum = ring_snapshot_checksum(buffer.data() + sizeof(h), h.total_size - sizeof(h));
+        memcpy(buffer.data(), &h, sizeof(h));
+        return buffer;
+}
+
+
+#pragma region ring_snapshot_file
+
+// 只读mmap快照文件
+class ring_snapshot_file {
+public:
+        static ring_snapshot_file new_with_path(const std::string& path, bool verify = true);
+
+        ring_snapshot_file(const ring_snapshot_file&) = delete;
+        ring_snapshot_file& operator=(const ring_snapshot_file&) = delete;
+        ring_snapshot_file(ring_snapshot_file&& other) noexcept
+        : __mem(other.__mem), __size(other.__size), __view(other.__view) {
+                other.__mem = nullptr;
+                other.__size = 0;
+        }
+
+        ~ring_snapshot_file() {
+                if (__mem != nullptr) munmap(__mem, __size);
+        }
+
+        const ring_snapshot_view& view() const noexcept {
+                return __view;
+        }
+private:
+        void* __mem;
+        size_t __size;
+        ring_snapshot_view __view;
+
+        ring_snapshot_file(void* mem, size_t size, const ring_snapshot_view& view) noexcept
+        : __mem(mem), __size(size), __view(view) {}
+};
+
+inline ring_snapshot_file ring_snapshot_file::new_with_path(const std::string& path, bool verify) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                throw RingSnapshotException("open " + path + " failed: " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size == 0) {
+                close(fd);
+                throw RingSnapshotException("empty snapshot file " + path);
+        }
+
+        void* mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED) {
+                throw RingSnapshotException("mmap " + path + " failed: " + strerror(errno));
+        }
+
+        try {
+                auto view = ring_snapshot_view::new_with_buffer(mem, st.st_size, verify);
+                return ring_snapshot_file(mem, st.st_size, view);
+        } catch (...) {
+                munmap(mem, st.st_size);
+                throw;
+        }
+}
+
+
+#pragma region ring_snapshot_router
+
+/**
+ * 持有快照内存的路由环，满足routed_pool的RouteRing
+ * capacity()为2^32，access(key_hash)即该hash所属节点的endpoint
+ * 通常在多个线程的连接池之间共享，所以以shared_ptr<const>发布
+ */
+class ring_snapshot_router {
+public:
+        static std::shared_ptr<const ring_snapshot_router> new_with_buffer(std::vector<char> snapshot, bool verify = true);
+
+        ring_snapshot_router(const ring_snapshot_router&) = delete;
+        ring_snapshot_router& operator=(const ring_snapshot_router&) = delete;
+
+        const ring_snapshot_view& view() const noexcept {
+                return __view;
+        }
+        const std::vector<ipv4>& endpoints() const noexcept {
+                return __endpoints;
+        }
+
+        size_t capacity() const noexcept {
+                return static_cast<size_t>(UINT32_MAX) + 1;
+        }
+        const ipv4& access(size_t key_hash) const {
+                return __endpoints[__view.route(static_cast<uint32_t>(key_hash))];
+        }
+private:
+        std::vector<char> __snapshot;
+        ring_snapshot_view __view;
+        // 按节点下标展开，access()返回引用
+        std::vector<ipv4> __endpoints;
+
+        ring_snapshot_router(std::vector<char> snapshot, const ring_snapshot_view& view)
+        : __snapshot(std::move(snapshot)), __view(view) {
+                __endpoints.reserve(__view.node_count());
+                for (size_t i = 0; i < __view.node_count(); ++i) {
+                        __endpoints.push_back(__view.endpoint(i));
+                }
+        }
+};
+
+inline std::shared_ptr<const ring_snapshot_router> ring_snapshot_router::new_with_buffer(std::vector<char> snapshot, bool verify) {
+        // vector移动后数据地址不变，视图在移动前建立即可
+        auto view = ring_snapshot_view::new_with_buffer(snapshot.data(), snapshot.size(), verify);
+        return std::shared_ptr<const ring_snapshot_router>(new ring_snapshot_router(std::move(snapshot), view));
+}
+
+
+#pragma region Delta
+
+/**
+ * 增量: 头部之后是varint流
+ *   removed nodes  : base节点下标，升序差分
+ *   added nodes    : addr, port
+ *   removed tokens : 升序差分
+ *   added tokens   : 升序差分 + 所属节点在target中的下标
+ * 未变化的token所属节点按endpoint对应到target节点表，不进入增量。
+ */
+struct ring_delta_header {
+        uint32_t magic;
+        uint16_t format;
+        uint16_t header_size;
+        uint64_t base_version;
+        uint64_t target_version;
+        uint32_t base_checksum;
+        uint32_t target_checksum;
+        uint32_t removed_nodes;
+        uint32_t added_nodes;
+        uint32_t removed_tokens;
+        uint32_t added_tokens;
+        // checksum置0时整个增量的FNV-1a，快照的校验和不覆盖头部中的版本
+        uint32_t checksum;
+        uint32_t reserved;
+};
+static_assert(sizeof(ring_delta_header) == 56);
+
+inline uint32_t __delta_checksum(ring_delta_header h, const void* delta, size_t size) noexcept {
+        h.checksum = 0;
+        uint32_t ret = ring_snapshot_checksum(&h, sizeof(h));
+        return ring_snapshot_checksum(static_cast<const char*>(delta) + sizeof(h), size - sizeof(h), ret);
+}
+
+inline void __delta_put(std::vector<char>& out, uint64_t v) {
+        while (v >= 0x80) {
+                out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+                v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+}
+
+inline uint64_t __delta_get(const uint8_t*& p, const uint8_t* end) {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+                if (p >= end) throw RingSnapshotException("truncated ring delta");
+                uint8_t b = *p++;
+                v |= static_cast<uint64_t>(b & 0x7F) << shift;
+                if (!(b & 0x80)) return v;
+        }
+        throw RingSnapshotException("bad varint in ring delta");
+}
+
+inline std::vector<char> ring_snapshot_diff(const ring_snapshot_view& base, const ring_snapshot_view& target) {
+        auto key_of = [](const ring_snapshot_node& n) { return std::make_tuple(n.addr, n.port); };
+
+        // 两个节点表都有序，归并得到增删
+        std::vector<uint32_t> removed_nodes;
+        std::vector<const ring_snapshot_node*> added_nodes;
+        size_t i = 0, j = 0;
+        while (i < base.node_count() || j < target.node_count()) {
+                if (j == target.node_count() || (i < base.node_count() && key_of(base.node(i)) < key_of(target.node(j)))) {
+                        removed_nodes.push_back(i++);
+                } else if (i == base.node_count() || key_of(target.node(j)) < key_of(base.node(i))) {
+                        added_nodes.push_back(&target.node(j++));
+                } else {
+                        i++, j++;
+                }
+        }
+
+        std::vector<uint32_t> removed_tokens;
+        std::vector<std::tuple<uint32_t, uint32_t>> added_tokens;
+        i = 0, j = 0;
+        while (i < base.token_count() || j < target.token_count()) {
+                if (j == target.token_count() || (i < base.token_count() && base.token(i) < target.token(j))) {
+                        removed_tokens.push_back(base.token(i++));
+                } else if (i == base.token_count() || target.token(j) < base.token(i)) {
+                        added_tokens.emplace_back(target.token(j), target.owner(j));
+                        j++;
+                } else {
+                        // 同一token换了节点，按删除+添加处理
+                        if (key_of(base.node(base.owner(i))) != key_of(target.node(target.owner(j)))) {
+                                removed_tokens.push_back(base.token(i));
+                                added_tokens.emplace_back(target.token(j), target.owner(j));
+                        }
+                        i++, j++;
+                }
+        }
+
+        ring_delta_header h {};
+        h.magic = RING_DELTA_MAGIC;
+        h.format = RING_SNAPSHOT_FORMAT;
+        h.header_size = sizeof(ring_delta_header);
+        h.base_version = base.version();
+        h.target_version = target.version();
+        h.base_checksum = base.checksum();
+        h.target_checksum = target.checksum();
+        h.removed_nodes = removed_nodes.size();
+        h.added_nodes = added_nodes.size();
+        h.removed_tokens = removed_tokens.size();
+        h.added_tokens = added_tokens.size();
+
+        std::vector<char> out(sizeof(h));
+        memcpy(out.data(), &h, sizeof(h));
+
+        uint64_t prev = 0;
+        for (auto index : removed_nodes) {
+                __delta_put(out, index - prev);
+                prev = index;
+        }
+        for (auto node : added_nodes) {
+                __delta_put(out, node->addr);
+                __delta_put(out, node->port);
+        }
+        prev = 0;
+        for (auto token : removed_tokens) {
+                __delta_put(out, token - prev);
+                prev = token;
+        }
+        prev = 0;
+        for (auto &[token, owner] : added_tokens) {
+                __delta_put(out, token - prev);
+                __delta_put(out, owner);
+                prev = token;
+        }
+        h.checksum = __delta_checksum(h, out.data(), out.size());
+        memcpy(out.data(), &h, sizeof(h));
+        return out;
+}
+
+// 在base上应用增量，结果与target逐字节相同
+inline std::vector<char> ring_snapshot_apply_delta(const ring_snapshot_view& base, const void* delta, size_t size) {
+        if (size < sizeof(ring_delta_header)) {
+                throw RingSnapshotException("ring delta too small");
+        }
+        ring_delta_header h;
+        memcpy(&h, delta, sizeof(h));
+        if (h.magic != RING_DELTA_MAGIC || h.format != RING_SNAPSHOT_FORMAT || h.header_size != sizeof(h)) {
+                throw RingSnapshotException("bad ring delta header");
+        }
+        if (__delta_checksum(h, delta, size) != h.checksum) {
+                throw RingSnapshotException("ring delta checksum mismatch");
+        }
+        if (h.base_version != base.version() || h.base_checksum != base.checksum()) {
+                throw RingSnapshotException("ring delta is based on version " + std::to_string(h.base_version)
+                        + ", have " + std::to_string(base.version()));
+        }
+
+        // 每个varint至少1字节，先按剩余字节数检查头部中的数量，再按它们分配内存
+        uint64_t min_bytes = (uint64_t)h.removed_nodes + 2 * (uint64_t)h.added_nodes
+                           + (uint64_t)h.removed_tokens + 2 * (uint64_t)h.added_tokens;
+        if (min_bytes > size - sizeof(h)) {
+                throw RingSnapshotException("truncated ring delta: counts need at least " + std::to_string(min_bytes)
+                        + " bytes, have " + std::to_string(size - sizeof(h)));
+        }
+        if (h.removed_nodes > base.node_count() || h.removed_tokens > base.token_count()) {
+                throw RingSnapshotException("ring delta removes more than the base has");
+        }
+
+        auto p = static_cast<const uint8_t*>(delta) + sizeof(h);
+        auto end = static_cast<const uint8_t*>(delta) + size;
+
+        // 新节点表: base去掉删除的，加上新增的，再排序
+        std::vector<bool> removed(base.node_count(), false);
+        uint64_t prev = 0;
+        for (uint32_t k = 0; k < h.removed_nodes; ++k) {
+                prev += __delta_get(p, end);
+                if (prev >= base.node_count()) throw RingSnapshotException("ring delta removes unknown node");
+                removed[prev] = true;
+        }
+
+        ring_snapshot_builder builder = ring_snapshot_builder::new_with_version(h.target_version);
+        std::vector<uint32_t> base_to_builder(base.node_count(), UINT32_MAX);
+        for (size_t k = 0; k < base.node_count(); ++k) {
+                if (removed[k]) continue;
+                base_to_builder[k] = builder.__nodes.size();
+                builder.__nodes.emplace_back(base.node(k).addr, base.node(k).port);
+        }
+        for (uint32_t k = 0; k < h.added_nodes; ++k) {
+                ipv4_i addr = static_cast<ipv4_i>(__delta_get(p, end));
+                port_t port = static_cast<port_t>(__delta_get(p, end));
+                builder.__nodes.emplace_back(addr, port);
+        }
+
+        // 增量中的owner是target下标，即排序后的builder下标
+        std::vector<uint32_t> order(builder.__nodes.size());
+        for (uint32_t k = 0; k < order.size(); ++k) order[k] = k;
+        std::sort(order.begin(), order.end(), [&builder](uint32_t a, uint32_t b) { return builder.__nodes[a] < builder.__nodes[b]; });
+
+        std::vector<uint32_t> removed_tokens(h.removed_tokens);
+        prev = 0;
+        for (auto &token : removed_tokens) {
+                prev += __delta_get(p, end);
+                token = static_cast<uint32_t>(prev);
+        }
+
+        builder.__tokens.reserve(base.token_count() - h.removed_tokens + h.added_tokens);
+        size_t r = 0;
+        for (size_t k = 0; k < base.token_count(); ++k) {
+                uint32_t token = base.token(k);
+                while (r < removed_tokens.size() && removed_tokens[r] < token) r++;
+                if (r < removed_tokens.size() && removed_tokens[r] == token) continue;
+
+                uint32_t owner = base_to_builder[base.owner(k)];
+                if (owner == UINT32_MAX) throw RingSnapshotException("ring delta keeps a token of a removed node");
+                builder.__tokens.emplace_back(token, owner);
+        }
+
+        prev = 0;
+        for (uint32_t k = 0; k < h.added_tokens; ++k) {
+                prev += __delta_get(p, end);
+                uint64_t owner = __delta_get(p, end);
+                if (owner >= order.size()) throw RingSnapshotException("ring delta token owner out of range");
+                builder.__tokens.emplace_back(static_cast<uint32_t>(prev), order[owner]);
+        }
+
+        auto ret = builder.build();
+        if (ring_snapshot_view::new_with_buffer(ret.data(), ret.size(), false).checksum() != h.target_checksum) {
+                throw RingSnapshotException("ring delta produced a snapshot with wrong checksum");
+        }
+        return ret;
+}
+
+#endif
@@ -0,0 +1,214 @@
+/**
+ * routed_pool在ring_snapshot_router上的行为测试
+ *
+ * 节点是127.0.0.1上只listen的socket，连接建立后由测试accept，
+ * 通过对端是否读到EOF判断连接池是否已经关闭了连接。
+ *
+ * g++ -std=c++20 -O2 -pthread -I../src/include conn_pool_test.cpp -o conn_pool_test
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "internet/conn_pool.h"
+#include "ring_snapshot.h"
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+                fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+                exit(1); \
+        } \
+} while (0)
+
+// 只有一个token时，hash不大于token的key都归该节点，环上其余部分按顺时针归下一个节点
+constexpr uint32_t TOKEN_A = 1u << 30, TOKEN_B = 3u << 30;
+constexpr uint32_t KEY_A = TOKEN_A - 1, KEY_B = TOKEN_B - 1;
+
+using pool_type = routed_pool<ring_snapshot_router>;
+
+struct test_node {
+        int fd;
+        ipv4 endpoint;
+
+        ~test_node() {
+                close(fd);
+        }
+
+        // 取出下一个已经建立的连接
+        int accept_one() const {
+                int c = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+                CHECK(c >= 0);
+                return c;
+        }
+};
+
+static std::unique_ptr<test_node> listen_node() {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in sa = to_sockaddr(ipv4::new_with_addr(0x7F000001, 0));
+        socklen_t len = sizeof(sa);
+        CHECK(fd >= 0);
+        CHECK(bind(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) == 0);
+        CHECK(listen(fd, 64) == 0);
+        CHECK(getsockname(fd, reinterpret_cast<sockaddr*>(&sa), &len) == 0);
+        return std::unique_ptr<test_node>(new test_node {fd, ipv4::new_with_addr(0x7F000001, ntohs(sa.sin_port))});
+}
+
+// 对端是否已经关闭: 读到EOF为true，暂无数据为false
+static bool peer_closed(int fd) {
+        pollfd p {fd, POLLIN, 0};
+        if (poll(&p, 1, 200) <= 0) return false;
+        char c;
+        return ::read(fd, &c, 1) == 0;
+}
+
+static std::shared_ptr<const ring_snapshot_router> make_ring(uint64_t version, const std::vector<std::pair<const test_node*, uint32_t>>& nodes) {
+        auto builder = ring_snapshot_builder::new_with_version(version);
+        for (auto &[node, token] : nodes) {
+                builder.add_node(node->endpoint, { token });
+        }
+        return ring_snapshot_router::new_with_buffer(builder.build());
+}
+
+static void test_router() {
+        auto a = listen_node(), b = listen_node();
+        auto ring = make_ring(1, {{a.get(), TOKEN_A}, {b.get(), TOKEN_B}});
+
+        CHECK(ring->capacity() == (size_t)1 << 32);
+        CHECK(ring->endpoints().size() == 2);
+        CHECK(ring->access(KEY_A) == a->endpoint);
+        CHECK(ring->access(TOKEN_A) == a->endpoint);
+        CHECK(ring->access(KEY_B) == b->endpoint);
+        // 最后一个token之后回到第一个节点
+        CHECK(ring->access(UINT32_MAX) == a->endpoint);
+        for (uint32_t h = 0; h < 1024; ++h) {
+                uint32_t hash = h * 4194319u;
+                CHECK(ring->access(hash) == ring->view().endpoint(ring->view().route(hash)));
+        }
+}
+
+static void test_lease() {
+        auto a = listen_node(), b = listen_node();
+        auto pool = pool_type::new_with_ring(make_ring(1, {{a.get(), TOKEN_A}, {b.get(), TOKEN_B}}), 2, 2);
+
+        // 同一节点的连接在途请求达到pipeline_depth后才新建第二个连接
+        auto l1 = pool->acquire(KEY_A);
+        auto l2 = pool->acquire(KEY_A);
+        CHECK(l1.connection().endpoint() == a->endpoint);
+        CHECK(&l1.connection() == &l2.connection());
+        auto l3 = pool->acquire(KEY_A);
+        CHECK(&l3.connection() != &l1.connection());
+        // 连接数到上限后选在途请求最少的连接
+        auto l4 = pool->acquire(KEY_A);
+        CHECK(&l4.connection() == &l3.connection());
+
+        auto lb = pool->acquire(KEY_B);
+        CHECK(lb.connection().endpoint() == b->endpoint);
+
+        // 出错的连接在途请求结束后被关闭，不再分配
+        int broken_peer = a->accept_one();
+        int other_peer = a->accept_one();
+        l1.fail();
+        { auto released = std::move(l1); }
+        { auto released = std::move(l2); }
+        { auto released = std::move(l4); }
+        auto l5 = pool->acquire(KEY_A);
+        CHECK(&l5.connection() == &l3.connection());
+        CHECK(peer_closed(broken_peer));
+        CHECK(!peer_closed(other_peer));
+
+        close(broken_peer);
+        close(other_peer);
+}
+
+// 断开但仍有在途请求的连接不占conns_per_node的名额
+static void test_broken_cap() {
+        auto a = listen_node();
+        auto pool = pool_type::new_with_ring(make_ring(1, {{a.get(), TOKEN_A}}), 2, 1);
+
+        auto l1 = pool->acquire(KEY_A);
+        auto l2 = pool->acquire(KEY_A);
+        CHECK(&l1.connection() != &l2.connection());
+        l1.fail();
+
+        auto l3 = pool->acquire(KEY_A);
+        CHECK(&l3.connection() != &l1.connection());
+        CHECK(&l3.connection() != &l2.connection());
+        // 两个可用连接都已满，不再新建
+        auto l4 = pool->acquire(KEY_A);
+        CHECK(&l4.connection() == &l2.connection() || &l4.connection() == &l3.connection());
+}
+
+static void test_publish() {
+        auto a = listen_node(), b = listen_node(), c = listen_node();
+        auto pool = pool_type::new_with_ring(make_ring(1, {{a.get(), TOKEN_A}, {b.get(), TOKEN_B}}), 2, 2);
+        CHECK(pool->epoch() == 1);
+
+        // a上一个在途请求，b上一个空闲连接
+        auto busy = pool->acquire(KEY_A);
+        int busy_peer = a->accept_one();
+        {
+                auto idle = pool->acquire(KEY_B);
+                CHECK(idle.connection().endpoint() == b->endpoint);
+        }
+        int idle_peer = b->accept_one();
+
+        // a与b离开，c接管整个环
+        pool->publish(make_ring(2, {{c.get(), TOKEN_A}}), { a->endpoint, b->endpoint });
+        CHECK(pool->epoch() == 2);
+        // 发布本身不触碰线程本地的连接
+        CHECK(!peer_closed(idle_peer));
+
+        // 下一次acquire同步新环: 空闲连接立即关闭，在途的连接等lease释放
+        auto moved = pool->acquire(KEY_B);
+        CHECK(moved.connection().endpoint() == c->endpoint);
+        CHECK(peer_closed(idle_peer));
+        CHECK(!peer_closed(busy_peer));
+        CHECK(busy.connection().alive());
+
+        // lease释放后，下一次acquire时sweep关闭draining中的连接
+        { auto released = std::move(busy); }
+        CHECK(!peer_closed(busy_peer));
+        auto again = pool->acquire(KEY_A);
+        CHECK(again.connection().endpoint() == c->endpoint);
+        CHECK(&again.connection() == &moved.connection());
+        CHECK(peer_closed(busy_peer));
+
+        close(busy_peer);
+        close(idle_peer);
+}
+
+static void test_threads() {
+        auto a = listen_node();
+        auto pool = pool_type::new_with_ring(make_ring(1, {{a.get(), TOKEN_A}}));
+
+        auto mine = pool->acquire(KEY_A);
+        tcp_connection* theirs = nullptr;
+        uint64_t seen = 0;
+        std::thread t([&]() {
+                auto l = pool->acquire(KEY_A);
+                theirs = &l.connection();
+                seen = pool->epoch();
+        });
+        t.join();
+        // 每个线程有自己的连接
+        CHECK(theirs != nullptr && theirs != &mine.connection());
+        CHECK(seen == 1);
+}
+
+int main() {
+        test_router();
+        test_lease();
+        test_broken_cap();
+        test_publish();
+        test_threads();
+        printf("conn_pool_test passed\n");
+        return 0;
+}
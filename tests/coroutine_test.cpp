@@ -0,0 +1,238 @@
+/**
+ * scheduler在spawn协程尚未结束时停止与销毁
+ *
+ * 每轮随机spawn若干协程: 有的很快结束，有的长时间sleep、等待对端不写的socket、
+ * 等待没有连接的listener，或者停在嵌套的子协程中。停止后run()必须返回，
+ * 参照计数与仍在等待的协程一致；销毁后帧中的对象全部析构，socket全部关闭。
+ * 另外检查注册失败时fd被关闭，以及等待空task时抛出异常。
+ *
+ * g++ -std=c++20 -O2 -pthread -I../src/include coroutine_test.cpp -o coroutine_test
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "internet/coroutine.h"
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+                fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+                exit(1); \
+        } \
+} while (0)
+
+constexpr size_t TEST_ROUNDS = 40;
+constexpr size_t TEST_TASKS = 64;
+// 不会在测试中到期
+constexpr uint64_t TEST_FOREVER_MS = 3600 * 1000;
+
+static bool fd_closed(int fd) {
+        return fcntl(fd, F_GETFD) < 0 && errno == EBADF;
+}
+
+struct round_state {
+        scheduler* sched;
+        // 仍在协程帧中的guard
+        size_t alive {0};
+        size_t finished {0};
+        size_t finishers {0};
+        std::vector<int> fds;
+};
+
+// 放在协程帧中，帧销毁时析构
+struct frame_guard {
+        round_state* state;
+
+        explicit frame_guard(round_state* s) noexcept : state(s) {
+                state->alive++;
+        }
+        ~frame_guard() {
+                state->alive--;
+        }
+};
+
+static task<void> finisher(round_state& st, size_t sleeps) {
+        frame_guard guard(&st);
+        for (size_t i = 0; i < sleeps; ++i) {
+                co_await sleep_for(1);
+        }
+        st.finished++;
+}
+
+static task<void> sleeper(round_state& st) {
+        frame_guard guard(&st);
+        co_await sleep_for(TEST_FOREVER_MS);
+}
+
+static task<size_t> reader(round_state& st, int fd) {
+        frame_guard guard(&st);
+        auto sock = async_socket::new_with_fd(*st.sched, fd);
+        char buf[16];
+        co_return co_await sock.read(buf, sizeof(buf));
+}
+
+static task<void> nested(round_state& st, int fd) {
+        frame_guard guard(&st);
+        co_await reader(st, fd);
+}
+
+static task<void> acceptor(round_state& st) {
+        frame_guard guard(&st);
+        auto listener = async_listener::new_with_endpoint(*st.sched, ipv4::new_with_addr(0x7F000001, 0));
+        co_await listener.accept();
+}
+
+// wait为真时等所有finisher结束再停止，否则第一次恢复就停止
+static task<void> stopper(round_state& st, bool wait) {
+        while (wait && st.finished < st.finishers) {
+                co_await sleep_for(1);
+        }
+        st.sched->stop();
+}
+
+static void test_shutdown() {
+        std::mt19937_64 rng(42);
+        for (size_t round = 0; round < TEST_ROUNDS; ++round) {
+                auto s = scheduler::new_scheduler(1000);
+                round_state st;
+                st.sched = s.get();
+                std::vector<int> peers;
+                // 全部协程到达等待点后仍存活的guard数
+                size_t pending = 0;
+
+                bool wait = rng() % 4 != 0;
+                size_t n = 1 + rng() % TEST_TASKS;
+                size_t stop_at = rng() % (n + 1);
+                for (size_t i = 0; i < n; ++i) {
+                        if (i == stop_at) s->spawn(stopper(st, wait));
+
+                        switch (rng() % 5) {
+                        case 0:
+                                st.finishers++;
+                                s->spawn(finisher(st, rng() % 4));
+                                break;
+                        case 1:
+                                pending++;
+                                s->spawn(sleeper(st));
+                                break;
+                        case 2:
+                        case 3: {
+                                int sv[2];
+                                CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == 0);
+                                st.fds.push_back(sv[0]);
+                                peers.push_back(sv[1]);
+                                if (rng() % 2) {
+                                        pending += 2;
+                                        s->spawn(nested(st, sv[0]));
+                                } else {
+                                        pending += 1;
+                                        s->spawn([](round_state& st, int fd) -> task<void> {
+                                                co_await reader(st, fd);
+                                        }(st, sv[0]));
+                                }
+                                break;
+                        }
+                        default:
+                                pending++;
+                                s->spawn(acceptor(st));
+                        }
+                }
+                if (stop_at == n) s->spawn(stopper(st, wait));
+
+                s->run();
+                if (wait) {
+                        CHECK(st.finished == st.finishers);
+                        CHECK(st.alive == pending);
+                }
+
+                // 随机选择显式销毁后复用scheduler，或者直接析构
+                if (rng() % 2) {
+                        s->destroy_spawned();
+                        CHECK(st.alive == 0);
+                        bool ran = false;
+                        s->spawn([](scheduler& s, bool& ran) -> task<void> {
+                                ran = true;
+                                s.stop();
+                                co_return;
+                        }(*s, ran));
+                        s->run();
+                        CHECK(ran);
+                }
+                s.reset();
+                CHECK(st.alive == 0);
+
+                // 协程已经接管的fd随帧关闭；被停止时尚未开始的协程不会接管，由测试关闭
+                for (size_t i = 0; i < st.fds.size(); ++i) {
+                        if (wait) CHECK(fd_closed(st.fds[i]));
+                        else if (!fd_closed(st.fds[i])) close(st.fds[i]);
+                        close(peers[i]);
+                }
+        }
+}
+
+// 注册失败时new_with_fd关闭fd
+static void test_fd_failure() {
+        auto s = scheduler::new_scheduler();
+
+        // 普通文件不能加入epoll
+        int fd = memfd_create("coroutine_test", MFD_CLOEXEC);
+        CHECK(fd >= 0);
+        bool thrown = false;
+        try {
+                async_socket::new_with_fd(*s, fd);
+        } catch (const EventLoopException&) {
+                thrown = true;
+        }
+        CHECK(thrown);
+        CHECK(fd_closed(fd));
+
+        thrown = false;
+        try {
+                async_socket::new_with_fd(*s, -1);
+        } catch (const ConnectionException&) {
+                thrown = true;
+        }
+        CHECK(thrown);
+}
+
+static task<int> answer() {
+        co_return 42;
+}
+
+// 等待被移走的task时抛出异常，不访问空的协程帧
+static void test_empty_task() {
+        auto s = scheduler::new_scheduler();
+        int got = 0;
+        bool thrown = false;
+        s->spawn([](scheduler& s, int& got, bool& thrown) -> task<void> {
+                task<int> a = answer();
+                task<int> b = std::move(a);
+                try {
+                        co_await a;
+                } catch (const std::logic_error&) {
+                        thrown = true;
+                }
+                got = co_await b;
+                s.stop();
+        }(*s, got, thrown));
+        s->run();
+        CHECK(thrown);
+        CHECK(got == 42);
+}
+
+int main() {
+        test_shutdown();
+        test_fd_failure();
+        test_empty_task();
+        printf("coroutine_test passed\n");
+        return 0;
+}
@@ -0,0 +1,263 @@
+/**
+ * port_allocator与逐个记录端口占用的参照实现对比
+ *
+ * 只有一个桶时所有目的地址共用一张位图，参照实现可以精确预测何时用尽；
+ * 多个桶时只检查同一目的地址不会拿到重复端口。另外检查time_wait隔离、
+ * 与ip_local_port_range重叠的范围被拒绝，以及tcp_connection与routed_pool
+ * 绑定分配到的端口并在关闭时归还。
+ *
+ * g++ -std=c++20 -O2 -pthread -I../src/include port_allocator_test.cpp -o port_allocator_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <map>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "internet/conn_pool.h"
+#include "internet/port_allocator.h"
+#include "ring_snapshot.h"
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+                fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+                exit(1); \
+        } \
+} while (0)
+
+// 低于linux默认ip_local_port_range的端口
+constexpr port_t TEST_LOW = 20000;
+constexpr size_t TEST_STEPS = 100000;
+constexpr size_t TEST_DSTS = 16;
+
+static ipv4 dst_of(size_t i) {
+        return ipv4::new_with_addr(0x0A000001 + i, 80);
+}
+
+// 单桶: 参照实现记录每个端口是否被占用
+static void test_single_bucket() {
+        constexpr size_t RANGE = 200;
+        auto ports = port_allocator::new_with_range(TEST_LOW, TEST_LOW + RANGE - 1, 1, 0);
+        CHECK(ports->capacity() == RANGE);
+
+        std::mt19937_64 rng(42);
+        std::map<port_t, size_t> held;
+        for (size_t step = 0; step < TEST_STEPS; ++step) {
+                if (held.empty() || rng() % 2 == 0) {
+                        size_t d = rng() % TEST_DSTS;
+                        port_t p = ports->acquire(dst_of(d));
+                        if (held.size() == RANGE) {
+                                CHECK(p == 0);
+                                continue;
+                        }
+                        CHECK(p >= TEST_LOW && p < TEST_LOW + RANGE);
+                        CHECK(held.count(p) == 0);
+                        held[p] = d;
+                } else {
+                        auto iter = held.begin();
+                        std::advance(iter, rng() % held.size());
+                        ports->release(dst_of(iter->second), iter->first);
+                        held.erase(iter);
+                }
+        }
+
+        // 范围之外的端口被忽略
+        ports->release(dst_of(0), TEST_LOW - 1);
+        ports->release(dst_of(0), TEST_LOW + RANGE);
+}
+
+// 多桶: 同一目的地址的端口不重复
+static void test_buckets() {
+        constexpr size_t RANGE = 64;
+        auto ports = port_allocator::new_with_range(TEST_LOW, TEST_LOW + RANGE - 1, 8, 0);
+
+        std::vector<std::set<port_t>> held(TEST_DSTS);
+        for (size_t d = 0; d < TEST_DSTS; ++d) {
+                while (port_t p = ports->acquire(dst_of(d))) {
+                        CHECK(held[d].insert(p).second);
+                }
+                CHECK(held[d].size() <= RANGE);
+        }
+        // 第一个目的地址独占它的桶，拿到整个范围
+        CHECK(held[0].size() == RANGE);
+
+        for (size_t d = 0; d < TEST_DSTS; ++d) {
+                for (auto p : held[d]) ports->release(dst_of(d), p);
+        }
+        CHECK(ports->acquire(dst_of(TEST_DSTS - 1)) != 0);
+}
+
+// 释放的端口在time_wait内不再分配给同一目的地址
+static void test_time_wait() {
+        constexpr uint32_t WAIT_MS = 200;
+        auto ports = port_allocator::new_with_range(TEST_LOW, TEST_LOW + 1, 1, WAIT_MS);
+        ipv4 dst = dst_of(0);
+
+        port_t a = ports->acquire(dst);
+        CHECK(a != 0);
+        ports->release(dst, a);
+        port_t b = ports->acquire(dst);
+        CHECK(b != 0 && b != a);
+        CHECK(ports->acquire(dst) == 0);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(WAIT_MS + 50));
+        CHECK(ports->acquire(dst) == a);
+        ports->release(dst, a);
+        ports->release(dst, b);
+        CHECK(ports->acquire(dst) == 0);
+
+        // 不同桶中的目的地址不受影响
+        auto shared = port_allocator::new_with_range(TEST_LOW, TEST_LOW, 64, WAIT_MS);
+        port_t p = shared->acquire(dst);
+        CHECK(p == TEST_LOW);
+        shared->release(dst, p);
+        bool other = false;
+        for (size_t d = 1; d < TEST_DSTS && !other; ++d) {
+                port_t q = shared->acquire(dst_of(d));
+                if (q != 0) {
+                        other = true;
+                        shared->release(dst_of(d), q);
+                }
+        }
+        CHECK(other);
+}
+
+static void test_range() {
+        auto [low, high] = system_port_range();
+        for (auto range : {std::pair<size_t, size_t>{low, high}, {low - 1, low}, {high, high}, {0, 100}, {200, 100}}) {
+                bool thrown = false;
+                try {
+                        port_allocator::new_with_range(range.first, range.second);
+                } catch (const PortAllocatorException&) {
+                        thrown = true;
+                }
+                CHECK(thrown);
+        }
+        CHECK(port_allocator::new_with_range()->capacity() > 0);
+}
+
+// 多线程同时分配与释放，同一端口不会同时被两个线程持有
+static void test_threads() {
+        constexpr size_t RANGE = 128;
+        constexpr size_t THREADS = 4;
+        auto ports = port_allocator::new_with_range(TEST_LOW, TEST_LOW + RANGE - 1, 1, 0);
+        std::vector<std::atomic<int>> owner(RANGE);
+        for (auto &o : owner) o.store(-1);
+
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < THREADS; ++t) {
+                threads.emplace_back([&, t]() {
+                        std::mt19937_64 rng(t);
+                        std::vector<port_t> mine;
+                        for (size_t i = 0; i < TEST_STEPS / THREADS; ++i) {
+                                if (mine.empty() || rng() % 2 == 0) {
+                                        port_t p = ports->acquire(dst_of(t));
+                                        if (p == 0) continue;
+                                        int expected = -1;
+                                        CHECK(owner[p - TEST_LOW].compare_exchange_strong(expected, (int)t));
+                                        mine.push_back(p);
+                                } else {
+                                        size_t k = rng() % mine.size();
+                                        port_t p = mine[k];
+                                        mine[k] = mine.back();
+                                        mine.pop_back();
+                                        owner[p - TEST_LOW].store(-1);
+                                        ports->release(dst_of(t), p);
+                                }
+                        }
+                        for (auto p : mine) {
+                                owner[p - TEST_LOW].store(-1);
+                                ports->release(dst_of(t), p);
+                        }
+                });
+        }
+        for (auto &t : threads) t.join();
+        CHECK(ports->acquire(dst_of(0)) != 0);
+}
+
+static port_t local_port(int fd) {
+        sockaddr_in sa {};
+        socklen_t len = sizeof(sa);
+        CHECK(getsockname(fd, reinterpret_cast<sockaddr*>(&sa), &len) == 0);
+        return ntohs(sa.sin_port);
+}
+
+// tcp_connection与routed_pool绑定分配到的端口，关闭后进入time_wait
+static void test_connection() {
+        int l = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in sa = to_sockaddr(ipv4::new_with_addr(0x7F000001, 0));
+        socklen_t len = sizeof(sa);
+        CHECK(l >= 0);
+        CHECK(bind(l, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) == 0);
+        CHECK(listen(l, 64) == 0);
+        CHECK(getsockname(l, reinterpret_cast<sockaddr*>(&sa), &len) == 0);
+        ipv4 ep = ipv4::new_with_addr(0x7F000001, ntohs(sa.sin_port));
+
+        constexpr port_t RANGE = 64;
+        std::shared_ptr<port_allocator> ports = port_allocator::new_with_range(TEST_LOW, TEST_LOW + RANGE - 1, 1, 60000);
+
+        port_t first;
+        {
+                auto conn = tcp_connection::new_with_allocator(ep, ports);
+                first = local_port(conn->fd());
+                CHECK(first >= TEST_LOW && first < TEST_LOW + RANGE);
+        }
+        // 关闭后端口在隔离期内，新连接换一个端口
+        {
+                auto conn = tcp_connection::new_with_allocator(ep, ports);
+                port_t second = local_port(conn->fd());
+                CHECK(second >= TEST_LOW && second < TEST_LOW + RANGE);
+                CHECK(second != first);
+        }
+
+        // 分配到的端口上已有监听的socket时换下一个
+        {
+                constexpr port_t BUSY = TEST_LOW + RANGE;
+                int busy = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                sockaddr_in bsa = to_sockaddr(ipv4::new_with_addr(0, BUSY));
+                CHECK(busy >= 0);
+                CHECK(bind(busy, reinterpret_cast<sockaddr*>(&bsa), sizeof(bsa)) == 0);
+                CHECK(listen(busy, 1) == 0);
+
+                std::shared_ptr<port_allocator> next = port_allocator::new_with_range(BUSY, BUSY + 1, 1, 60000);
+                auto conn = tcp_connection::new_with_allocator(ep, next);
+                CHECK(local_port(conn->fd()) == BUSY + 1);
+                close(busy);
+        }
+
+        // 没有分配器时由内核选择
+        auto plain = tcp_connection::new_with_allocator(ep, nullptr);
+        CHECK(local_port(plain->fd()) != 0);
+
+        auto builder = ring_snapshot_builder::new_with_version(1);
+        builder.add_node(ep, { 1u << 31 });
+        auto ring = ring_snapshot_router::new_with_buffer(builder.build());
+        auto pool = routed_pool<ring_snapshot_router>::new_with_ring(ring, 2, 1, DEFAULT_POOL_THREADS, ports);
+        auto l1 = pool->acquire(0);
+        auto l2 = pool->acquire(0);
+        port_t p1 = local_port(l1.connection().fd()), p2 = local_port(l2.connection().fd());
+        CHECK(p1 >= TEST_LOW && p1 < TEST_LOW + RANGE);
+        CHECK(p2 >= TEST_LOW && p2 < TEST_LOW + RANGE);
+        CHECK(p1 != p2 && p1 != first);
+
+        close(l);
+}
+
+int main() {
+        test_single_bucket();
+        test_buckets();
+        test_time_wait();
+        test_range();
+        test_threads();
+        test_connection();
+        printf("port_allocator_test passed\n");
+        return 0;
+}
@@ -0,0 +1,204 @@
+/**
+ * prefix_table(DIR-24-8)与逐个长度查找规则的参照实现对比
+ *
+ * 前缀集中在少数几个/16里，使长于24位的规则共用tbl8组，
+ * 随机插入、更新、删除后用lookup与lookup_bulk检查最长匹配结果，
+ * 删除后必须回落到更短的覆盖规则。
+ *
+ * g++ -std=c++20 -O2 -pthread -I../src/include prefix_table_test.cpp -o prefix_table_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <iterator>
+#include <map>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "internet/prefix_table.h"
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+                fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+                exit(1); \
+        } \
+} while (0)
+
+constexpr size_t TEST_STEPS = 20000;
+constexpr size_t TEST_LOOKUPS = 512;
+constexpr ipv4_i TEST_BASES[] = {0x0A000000, 0x0A010000, 0xC0A80000};
+
+static ipv4_i mask_of(uint8_t depth) noexcept {
+        return depth == 0 ? 0 : ~0u << (32 - depth);
+}
+
+// 参照实现: 从最长的长度开始逐个查找
+struct reference {
+        std::map<std::pair<ipv4_i, uint8_t>, uint32_t> rules;
+
+        uint32_t lookup(ipv4_i ip) const {
+                for (int d = 32; d >= 0; --d) {
+                        auto iter = rules.find({ ip & mask_of(d), (uint8_t)d });
+                        if (iter != rules.end()) return iter->second;
+                }
+                return PREFIX_NOT_FOUND;
+        }
+};
+
+// 落在测试用/16中的地址，低位集中在少数几个/24
+static ipv4_i random_addr(std::mt19937_64& rng) {
+        ipv4_i base = TEST_BASES[rng() % (sizeof(TEST_BASES) / sizeof(TEST_BASES[0]))];
+        return base | ((rng() % 8) << 8) | (rng() % 256);
+}
+
+// 短于8位的规则每次要写上百万项tbl24，只在test_groups中覆盖
+static uint8_t random_depth(std::mt19937_64& rng) {
+        switch (rng() % 4) {
+        case 0:
+                return 8 + rng() % 17;
+        case 1:
+                return 16 + rng() % 9;
+        default:
+                return 25 + rng() % 8;
+        }
+}
+
+static void check_lookups(const prefix_table& table, const reference& ref, std::mt19937_64& rng) {
+        std::vector<ipv4_i> ips(TEST_LOOKUPS);
+        for (auto &ip : ips) {
+                // 少量完全随机的地址，大多不匹配任何规则
+                ip = rng() % 16 == 0 ? (ipv4_i)rng() : random_addr(rng);
+        }
+        std::vector<uint32_t> bulk(ips.size());
+        table.lookup_bulk(ips.data(), bulk.data(), ips.size());
+
+        for (size_t i = 0; i < ips.size(); ++i) {
+                uint32_t expected = ref.lookup(ips[i]);
+                CHECK(table.lookup(ips[i]) == expected);
+                CHECK(bulk[i] == expected);
+        }
+        CHECK(table.size() == ref.rules.size());
+}
+
+static void test_random() {
+        std::mt19937_64 rng(42);
+        // 3个/16 * 8个/24，组数足够
+        auto table = prefix_table::new_with_groups(64);
+        reference ref;
+
+        for (size_t step = 0; step < TEST_STEPS; ++step) {
+                switch (rng() % 8) {
+                case 0:
+                case 1:
+                case 2:
+                case 3: {
+                        uint8_t depth = random_depth(rng);
+                        ipv4_i prefix = random_addr(rng) & mask_of(depth);
+                        uint32_t value = rng() % (PREFIX_MAX_VALUE + 1);
+                        // prefix中depth之后的位被忽略
+                        table->insert(prefix | (~mask_of(depth) & (ipv4_i)rng()), depth, value);
+                        ref.rules[{ prefix, depth }] = value;
+                        break;
+                }
+                case 4:
+                case 5:
+                case 6: {
+                        if (ref.rules.empty()) break;
+                        auto iter = ref.rules.begin();
+                        std::advance(iter, rng() % ref.rules.size());
+                        CHECK(table->remove(iter->first.first, iter->first.second));
+                        ref.rules.erase(iter);
+                        break;
+                }
+                default: {
+                        uint8_t depth = random_depth(rng);
+                        ipv4_i prefix = random_addr(rng) & mask_of(depth);
+                        bool exists = ref.rules.count({ prefix, depth }) > 0;
+                        CHECK(table->remove(prefix, depth) == exists);
+                        ref.rules.erase({ prefix, depth });
+                }
+                }
+                if (step % 32 == 0) check_lookups(*table, ref, rng);
+        }
+        check_lookups(*table, ref, rng);
+
+        // 全部删除后回到空表
+        while (!ref.rules.empty()) {
+                auto iter = ref.rules.begin();
+                CHECK(table->remove(iter->first.first, iter->first.second));
+                ref.rules.erase(iter);
+        }
+        check_lookups(*table, ref, rng);
+}
+
+// tbl8组不回收；同一个/24重新插入长前缀时复用原来的组，组用尽时插入失败且表不变
+static void test_groups() {
+        auto table = prefix_table::new_with_groups(2);
+        table->insert(0x0A000000, 8, 1);
+        table->insert(0x0A000080, 25, 2);
+        CHECK(table->lookup(0x0A000081) == 2);
+        CHECK(table->lookup(0x0A000001) == 1);
+
+        CHECK(table->remove(0x0A000080, 25));
+        CHECK(table->lookup(0x0A000081) == 1);
+        table->insert(0x0A0000F0, 28, 3);
+        CHECK(table->lookup(0x0A0000F1) == 3);
+
+        table->insert(0x0A000100, 32, 4);
+        bool thrown = false;
+        try {
+                table->insert(0x0A000200, 30, 5);
+        } catch (const PrefixTableException&) {
+                thrown = true;
+        }
+        CHECK(thrown);
+        CHECK(table->size() == 3);
+        CHECK(table->lookup(0x0A000201) == 1);
+        CHECK(table->lookup(0x0A000100) == 4);
+        CHECK(table->lookup(0x0A000101) == 1);
+
+        // 已有组的/24内仍可插入，/24及更短的规则不需要组
+        table->insert(0x0A000104, 30, 6);
+        table->insert(0x0A000200, 24, 7);
+        CHECK(table->lookup(0x0A000105) == 6);
+        CHECK(table->lookup(0x0A000201) == 7);
+
+        // 更短的规则写进已有的组，但不覆盖组内更长的规则
+        table->insert(0x0A000000, 16, 8);
+        CHECK(table->lookup(0x0A000100) == 4);
+        CHECK(table->lookup(0x0A000110) == 8);
+        CHECK(table->remove(0x0A000000, 16));
+        CHECK(table->lookup(0x0A000110) == 1);
+
+        CHECK(table->lookup(0x0B000000) == PREFIX_NOT_FOUND);
+        table->insert("0.0.0.0/0", 9);
+        CHECK(table->lookup(0x0B000000) == 9);
+}
+
+static void test_parse() {
+        auto [prefix, depth] = prefix_table::parse_cidr("192.168.1.0/24");
+        CHECK(prefix == 0xC0A80100 && depth == 24);
+        std::tie(prefix, depth) = prefix_table::parse_cidr("0.0.0.0/0");
+        CHECK(prefix == 0 && depth == 0);
+
+        for (const char* bad : {"10.0.0.0", "10.0.0.0/", "10.0.0.0/33", "10.0.0.0/2a", "10.0.0.0/100"}) {
+                bool thrown = false;
+                try {
+                        prefix_table::parse_cidr(bad);
+                } catch (const InvalidIpv4Address&) {
+                        thrown = true;
+                }
+                CHECK(thrown);
+        }
+}
+
+int main() {
+        test_random();
+        test_groups();
+        test_parse();
+        printf("prefix_table_test passed\n");
+        return 0;
+}
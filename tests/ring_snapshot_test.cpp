@@ -0,0 +1,237 @@
+/**
+ * ring_snapshot的构建、路由与增量测试
+ *
+ * 随机生成节点与token(包括冲突的token)，路由结果与逐个比较token的参照实现对比；
+ * 随机变更得到下一个版本，diff后在base上apply必须与target逐字节相同。
+ * 截断、逐字节翻转(包括头部中的版本)以及基于其他版本的增量必须被拒绝，不能得到错误的快照。
+ *
+ * g++ -std=c++20 -O2 -pthread -I../src/include ring_snapshot_test.cpp -o ring_snapshot_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "ring_snapshot.h"
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+                fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+                exit(1); \
+        } \
+} while (0)
+
+constexpr size_t TEST_VERSIONS = 200;
+constexpr size_t TEST_ROUTES = 256;
+constexpr size_t TEST_CORRUPT_ROUNDS = 8;
+
+using endpoint_key = std::tuple<ipv4_i, port_t>;
+
+// 参照实现: 节点 -> token
+struct reference {
+        uint64_t version {1};
+        std::map<endpoint_key, std::vector<uint32_t>> nodes;
+
+        std::vector<char> build() const {
+                auto builder = ring_snapshot_builder::new_with_version(version);
+                for (auto &[key, tokens] : nodes) {
+                        builder.add_node(ipv4::new_with_addr(std::get<0>(key), std::get<1>(key)), tokens);
+                }
+                return builder.build();
+        }
+
+        // token冲突时归(addr, port)最小的节点
+        std::map<uint32_t, endpoint_key> owners() const {
+                std::map<uint32_t, endpoint_key> ret;
+                for (auto &[key, tokens] : nodes) {
+                        for (auto token : tokens) ret.try_emplace(token, key);
+                }
+                return ret;
+        }
+};
+
+static std::vector<uint32_t> random_tokens(std::mt19937_64& rng) {
+        std::vector<uint32_t> tokens(1 + rng() % 16);
+        for (auto &t : tokens) {
+                // 少量取值很小的token，制造冲突
+                t = rng() % 8 == 0 ? rng() % 64 : (uint32_t)rng();
+        }
+        return tokens;
+}
+
+static endpoint_key random_endpoint(std::mt19937_64& rng) {
+        return { 0x0A000000 + rng() % 64, static_cast<port_t>(7000 + rng() % 4) };
+}
+
+static void mutate(reference& ref, std::mt19937_64& rng) {
+        ref.version++;
+        switch (rng() % 4) {
+        case 0:
+                // 不变
+                return;
+        case 1:
+                for (auto iter = ref.nodes.begin(); iter != ref.nodes.end(); ) {
+                        iter = rng() % 8 == 0 ? ref.nodes.erase(iter) : std::next(iter);
+                }
+                break;
+        case 2:
+                for (auto &[key, tokens] : ref.nodes) {
+                        if (rng() % 4 != 0) continue;
+                        tokens[rng() % tokens.size()] = rng();
+                        if (rng() % 2) tokens.push_back(rng());
+                }
+                break;
+        default:
+                break;
+        }
+        for (size_t k = rng() % 4; k > 0; --k) {
+                ref.nodes[random_endpoint(rng)] = random_tokens(rng);
+        }
+}
+
+static void check_routes(const ring_snapshot_view& view, const reference& ref, std::mt19937_64& rng) {
+        auto owners = ref.owners();
+        CHECK(view.version() == ref.version);
+        CHECK(view.node_count() == ref.nodes.size());
+        CHECK(view.token_count() == owners.size());
+        if (owners.empty()) return;
+
+        for (size_t i = 0; i < TEST_ROUTES; ++i) {
+                uint32_t hash = i == 0 ? UINT32_MAX : i == 1 ? 0 : (uint32_t)rng();
+                // 顺时针第一个不小于hash的token，越过最大的token后回到第一个
+                auto iter = owners.lower_bound(hash);
+                if (iter == owners.end()) iter = owners.begin();
+                const ring_snapshot_node& node = view.route_node(hash);
+                CHECK(node.addr == std::get<0>(iter->second));
+                CHECK(node.port == std::get<1>(iter->second));
+        }
+}
+
+static void check_delta_rejected(const ring_snapshot_view& base, const std::vector<char>& delta, const std::vector<char>& target) {
+        // 必须抛出RingSnapshotException，除非损坏恰好不影响结果
+        auto rejected = [&](const std::vector<char>& bad) {
+                try {
+                        auto ret = ring_snapshot_apply_delta(base, bad.data(), bad.size());
+                        return ret == target;
+                } catch (const RingSnapshotException&) {
+                        return true;
+                }
+        };
+
+        for (size_t len = 0; len < delta.size(); ++len) {
+                std::vector<char> cut(delta.begin(), delta.begin() + len);
+                bool thrown = false;
+                try {
+                        ring_snapshot_apply_delta(base, cut.data(), cut.size());
+                } catch (const RingSnapshotException&) {
+                        thrown = true;
+                }
+                CHECK(thrown);
+        }
+        for (size_t i = 0; i < delta.size(); ++i) {
+                for (uint8_t bit : {0x01, 0x80}) {
+                        std::vector<char> bad = delta;
+                        bad[i] ^= bit;
+                        CHECK(rejected(bad));
+                }
+        }
+        // 头部中的数量被改大且校验和仍然正确时，不能按它分配内存
+        ring_delta_header h;
+        memcpy(&h, delta.data(), sizeof(h));
+        h.added_tokens = UINT32_MAX;
+        h.checksum = __delta_checksum(h, delta.data(), delta.size());
+        std::vector<char> bad = delta;
+        memcpy(bad.data(), &h, sizeof(h));
+        bool thrown = false;
+        try {
+                ring_snapshot_apply_delta(base, bad.data(), bad.size());
+        } catch (const RingSnapshotException& e) {
+                thrown = strstr(e.what(), "truncated") != nullptr;
+        }
+        CHECK(thrown);
+}
+
+static void test_versions() {
+        std::mt19937_64 rng(42);
+        reference ref;
+        for (size_t k = 0; k < 8; ++k) {
+                ref.nodes[random_endpoint(rng)] = random_tokens(rng);
+        }
+
+        std::vector<char> base = ref.build();
+        size_t corrupt_rounds = 0;
+        for (size_t v = 0; v < TEST_VERSIONS; ++v) {
+                auto base_view = ring_snapshot_view::new_with_buffer(base.data(), base.size());
+                check_routes(base_view, ref, rng);
+
+                mutate(ref, rng);
+                std::vector<char> target = ref.build();
+                auto target_view = ring_snapshot_view::new_with_buffer(target.data(), target.size());
+
+                std::vector<char> delta = ring_snapshot_diff(base_view, target_view);
+                CHECK(ring_snapshot_apply_delta(base_view, delta.data(), delta.size()) == target);
+
+                // 增量只能应用在它的base上
+                if (target_view.checksum() != base_view.checksum()) {
+                        bool thrown = false;
+                        try {
+                                ring_snapshot_apply_delta(target_view, delta.data(), delta.size());
+                        } catch (const RingSnapshotException&) {
+                                thrown = true;
+                        }
+                        CHECK(thrown);
+                }
+
+                if (v % (TEST_VERSIONS / TEST_CORRUPT_ROUNDS) == 0) {
+                        check_delta_rejected(base_view, delta, target);
+                        corrupt_rounds++;
+                }
+                base = std::move(target);
+        }
+        CHECK(corrupt_rounds == TEST_CORRUPT_ROUNDS);
+}
+
+// 快照本身被改动时校验失败
+static void test_corrupt_snapshot() {
+        std::mt19937_64 rng(7);
+        reference ref;
+        for (size_t k = 0; k < 4; ++k) {
+                ref.nodes[random_endpoint(rng)] = random_tokens(rng);
+        }
+        std::vector<char> snapshot = ref.build();
+
+        for (size_t i = 0; i < snapshot.size(); i += 7) {
+                std::vector<char> bad = snapshot;
+                bad[i] ^= 0x10;
+                bool thrown = false;
+                try {
+                        ring_snapshot_view::new_with_buffer(bad.data(), bad.size());
+                } catch (const RingSnapshotException&) {
+                        thrown = true;
+                }
+                // 头部中的版本与保留字段不在校验范围内
+                if (!thrown) {
+                        CHECK(i < sizeof(ring_snapshot_header));
+                }
+        }
+
+        bool thrown = false;
+        try {
+                ring_snapshot_view::new_with_buffer(snapshot.data(), snapshot.size() / 2);
+        } catch (const RingSnapshotException&) {
+                thrown = true;
+        }
+        CHECK(thrown);
+}
+
+int main() {
+        test_versions();
+        test_corrupt_snapshot();
+        printf("ring_snapshot_test passed\n");
+        return 0;
+}
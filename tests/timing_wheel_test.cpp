@@ -0,0 +1,243 @@
+/**
+ * timing_wheel与逐个比较到期时间的参照实现对比
+ *
+ * 随机设置、取消、在回调中重新设置定时器，并以小步、跳到next_event()以及
+ * 跨越多层的大步推进时间；每个回调必须恰好在到期tick执行，推进结束后
+ * 参照实现中不能剩下已经到期的定时器。
+ *
+ * g++ -std=c++20 -O2 -pthread -I../src/include timing_wheel_test.cpp -o timing_wheel_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "internet/timing_wheel.h"
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+                fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+                exit(1); \
+        } \
+} while (0)
+
+constexpr size_t TEST_TIMERS = 512;
+constexpr size_t TEST_STEPS = 200000;
+
+// 参照实现: 每个定时器的到期tick，0表示未启动
+struct reference {
+        timing_wheel* wheel;
+        std::mt19937_64* rng;
+        std::vector<uint64_t> expires;
+        std::vector<timer_node> nodes;
+        size_t fired {0};
+
+        explicit reference(size_t n) : expires(n, 0), nodes(n) {}
+
+        size_t index(const timer_node* node) const noexcept {
+                return node - nodes.data();
+        }
+
+        uint64_t random_delay() {
+                // 大多落在第0、1层，少量跨越更高的层
+                switch ((*rng)() % 8) {
+                case 0:
+                        return 1 + (*rng)() % (1ULL << 30);
+                case 1:
+                        return 1 + (*rng)() % (1ULL << 18);
+                default:
+                        return 1 + (*rng)() % 4096;
+                }
+        }
+
+        void schedule(size_t i, uint64_t delay) {
+                wheel->schedule(nodes[i], delay);
+                expires[i] = wheel->now() + delay;
+        }
+
+        uint64_t earliest() const noexcept {
+                uint64_t ret = WHEEL_NEVER;
+                for (auto e : expires) {
+                        if (e != 0) ret = std::min(ret, e);
+                }
+                return ret;
+        }
+};
+
+static void on_expire(timer_node* node) {
+        auto ref = static_cast<reference*>(node->data);
+        size_t i = ref->index(node);
+        CHECK(!node->armed());
+        CHECK(ref->expires[i] == ref->wheel->now());
+        ref->expires[i] = 0;
+        ref->fired++;
+        // 回调中重新设置
+        if (i % 3 == 0) {
+                ref->schedule(i, ref->random_delay());
+        }
+}
+
+static void check_state(const reference& ref) {
+        size_t armed = 0;
+        for (size_t i = 0; i < ref.nodes.size(); ++i) {
+                CHECK(ref.nodes[i].armed() == (ref.expires[i] != 0));
+                if (ref.expires[i] == 0) continue;
+                armed++;
+                CHECK(ref.expires[i] > ref.wheel->now());
+                CHECK(ref.nodes[i].expires() == ref.expires[i]);
+        }
+        CHECK(ref.wheel->size() == armed);
+
+        // next_event可能是更早的降级，但不能晚于最早的到期
+        uint64_t next = ref.wheel->next_event();
+        CHECK((next == WHEEL_NEVER) == (armed == 0));
+        CHECK(next > ref.wheel->now());
+        CHECK(next <= ref.earliest());
+}
+
+static void test_random() {
+        std::mt19937_64 rng(42);
+        auto wheel = timing_wheel::new_with_tick(1000);
+        reference ref(TEST_TIMERS);
+        ref.wheel = wheel.get();
+        ref.rng = &rng;
+        for (auto &node : ref.nodes) {
+                node.callback = on_expire;
+                node.data = &ref;
+        }
+
+        for (size_t step = 0; step < TEST_STEPS; ++step) {
+                size_t i = rng() % TEST_TIMERS;
+                switch (rng() % 8) {
+                case 0:
+                case 1:
+                case 2:
+                        ref.schedule(i, ref.random_delay());
+                        break;
+                case 3:
+                        wheel->cancel(ref.nodes[i]);
+                        ref.expires[i] = 0;
+                        break;
+                default: {
+                        uint64_t now = wheel->now();
+                        uint64_t to;
+                        switch (rng() % 4) {
+                        case 0:
+                                to = std::min<uint64_t>(wheel->next_event(), now + (1ULL << 32));
+                                break;
+                        case 1:
+                                to = now + (rng() % (1ULL << 20));
+                                break;
+                        default:
+                                to = now + rng() % 64;
+                        }
+
+                        // 参照实现: (now, to]内到期的定时器都要执行，回调中重新设置的不超过to时也一样
+                        size_t before = ref.fired;
+                        size_t ret = wheel->advance(to);
+                        CHECK(wheel->now() == std::max(now, to));
+                        CHECK(ret == ref.fired - before);
+                        check_state(ref);
+                }
+                }
+        }
+        check_state(ref);
+        CHECK(ref.fired > TEST_STEPS / 8);
+}
+
+// 到期tick恰好在各层边界上时，降级后仍在原tick执行
+static void test_cascade() {
+        auto wheel = timing_wheel::new_with_tick(0);
+        std::vector<uint64_t> delays;
+        for (size_t level = 0; level < WHEEL_LEVELS; ++level) {
+                size_t shift = level * WHEEL_BITS;
+                if (shift >= 40) break;
+                delays.push_back(1ULL << shift);
+                delays.push_back((1ULL << shift) + 1);
+                delays.push_back((1ULL << (shift + WHEEL_BITS)) - 1);
+        }
+
+        struct fire_log {
+                timing_wheel* wheel;
+                size_t fired {0};
+                size_t late {0};
+        } log { wheel.get() };
+        std::vector<timer_node> nodes(delays.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+                nodes[i].data = &log;
+                nodes[i].callback = [](timer_node* n) {
+                        auto l = static_cast<fire_log*>(n->data);
+                        l->fired++;
+                        if (n->expires() != l->wheel->now()) l->late++;
+                };
+                wheel->schedule(nodes[i], delays[i]);
+        }
+
+        // 只在next_event处推进，逐个确认
+        while (wheel->size() > 0) {
+                uint64_t next = wheel->next_event();
+                CHECK(next != WHEEL_NEVER);
+                wheel->advance(next);
+        }
+        CHECK(log.fired == nodes.size());
+        CHECK(log.late == 0);
+        CHECK(wheel->next_event() == WHEEL_NEVER);
+}
+
+// 回调抛出异常后剩余的定时器留在时间轮中，下一次advance时执行
+static void test_throw() {
+        auto wheel = timing_wheel::new_with_tick(0);
+        struct throw_log {
+                size_t fired {0};
+        } log;
+        std::vector<timer_node> nodes(4);
+        for (auto &node : nodes) {
+                node.data = &log;
+                node.callback = [](timer_node* n) {
+                        auto l = static_cast<throw_log*>(n->data);
+                        if (l->fired++ == 0) throw std::runtime_error("expire");
+                };
+                wheel->schedule(node, 10);
+        }
+
+        bool thrown = false;
+        try {
+                wheel->advance(20);
+        } catch (const std::runtime_error&) {
+                thrown = true;
+        }
+        CHECK(thrown);
+        CHECK(log.fired == 1);
+        CHECK(wheel->now() == 10);
+        CHECK(wheel->size() == 3);
+        CHECK(wheel->next_event() == 10);
+
+        CHECK(wheel->advance(20) == 3);
+        CHECK(log.fired == 4);
+        CHECK(wheel->size() == 0);
+        CHECK(wheel->now() == 20);
+
+        // 剩余节点可以被取消或析构
+        wheel->schedule(nodes[0], 1);
+        wheel->schedule(nodes[1], 1);
+        log.fired = 0;
+        try {
+                wheel->advance(21);
+        } catch (const std::runtime_error&) {}
+        CHECK(wheel->size() == 1);
+        nodes[0].cancel();
+        nodes[1].cancel();
+        CHECK(wheel->size() == 0);
+        CHECK(wheel->next_event() == WHEEL_NEVER);
+}
+
+int main() {
+        test_random();
+        test_cascade();
+        test_throw();
+        printf("timing_wheel_test passed\n");
+        return 0;
+}